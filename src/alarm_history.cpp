@@ -0,0 +1,48 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ * Copyright (C) 2024 Håvard F. Aasen <havard.f.aasen@pfft.no>
+ */
+
+#include "alarm_history.h"
+
+#include <algorithm>
+
+
+void Alarm_history::raise(const int32_t code, const clock::time_point now) noexcept
+{
+    // A rising edge without a falling edge, e.g. while the drive was offline.
+    clear(now);
+    count++;
+    newest() = {code, std::chrono::system_clock::now(), {}, now, {}, true};
+}
+
+void Alarm_history::set_code(const int32_t code) noexcept
+{
+    if (active())
+        newest().code = code;
+}
+
+void Alarm_history::clear(const clock::time_point now) noexcept
+{
+    if (!active())
+        return;
+    update(now);
+    newest().cleared = std::chrono::system_clock::now();
+    newest().active = false;
+}
+
+void Alarm_history::update(const clock::time_point now) noexcept
+{
+    if (active())
+        newest().duration = now - newest().start;
+}
+
+const Alarm_history::Entry& Alarm_history::operator[](const std::size_t i) const noexcept
+{
+    return entries[(count - 1 - i) % capacity];
+}
+
+std::size_t Alarm_history::size() const noexcept
+{
+    return std::min(std::size_t{count}, capacity);
+}
@@ -0,0 +1,64 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ * Copyright (C) 2024 Håvard F. Aasen <havard.f.aasen@pfft.no>
+ */
+
+/**
+ * @file
+ * @brief The most recent alarms of one drive.
+ */
+
+#ifndef LICHUAN_A4_ALARM_HISTORY_H
+#define LICHUAN_A4_ALARM_HISTORY_H
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+
+/**
+ * @brief Fixed size history of alarms, the oldest is overwritten.
+ *
+ * An alarm is raised on the rising edge of the alarm output of the drive,
+ * and cleared on the falling edge. No memory is allocated.
+ */
+class Alarm_history {
+public:
+    using clock = std::chrono::steady_clock;
+    static constexpr std::size_t capacity {8};
+
+    struct Entry {
+        int32_t code{};
+        std::chrono::system_clock::time_point first_seen{};     /*!< wall clock time of the rising edge */
+        std::chrono::system_clock::time_point cleared{};        /*!< wall clock time of the falling edge */
+        clock::time_point start{};
+        clock::duration duration{};     /*!< how long the alarm was active, so far while active */
+        bool active{false};
+    };
+
+    /** Start a new alarm with error @p code. */
+    void raise(int32_t code, clock::time_point now) noexcept;
+    /** Replace the error code of the active alarm, after a confirmation read. */
+    void set_code(int32_t code) noexcept;
+    /** Clear the active alarm, if any. */
+    void clear(clock::time_point now) noexcept;
+    /** Update the duration of the active alarm. */
+    void update(clock::time_point now) noexcept;
+
+    /** Entry @p i, where 0 is the newest. Only valid for i < size(). */
+    [[nodiscard]] const Entry& operator[](std::size_t i) const noexcept;
+    [[nodiscard]] std::size_t size() const noexcept;
+    /** Number of alarms raised, including the overwritten ones. */
+    [[nodiscard]] uint32_t total() const noexcept { return count; }
+    [[nodiscard]] bool active() const noexcept { return count > 0 && newest().active; }
+
+private:
+    std::array<Entry, capacity> entries{};
+    uint32_t count{};
+
+    [[nodiscard]] Entry& newest() noexcept { return entries[(count - 1) % capacity]; }
+    [[nodiscard]] const Entry& newest() const noexcept { return entries[(count - 1) % capacity]; }
+};
+
+#endif // LICHUAN_A4_ALARM_HISTORY_H
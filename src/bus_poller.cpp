@@ -0,0 +1,36 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ * Copyright (C) 2024 Håvard F. Aasen <havard.f.aasen@pfft.no>
+ */
+
+#include "bus_poller.h"
+
+#include <algorithm>
+#include <chrono>
+
+
+void Bus_poller::run(const std::atomic<bool>& done)
+{
+    if (devices.empty())
+        return;
+
+    // Spread the slow register groups of each drive evenly over their period.
+    for (std::size_t i = 0; i < devices.size(); i++)
+        devices[i]->set_phase(static_cast<double>(i) / static_cast<double>(devices.size()));
+
+    timer.start();
+    while (!done) {
+        for (auto *servo : devices) {
+            servo->read_data();
+        }
+
+        // Don't scan to fast, and not delay more than a few seconds.
+        const double modbus_polling = devices.front()->modbus_polling();
+        const auto seconds = std::chrono::duration<double>(std::clamp(modbus_polling, 0.001, 2.0));
+        timer.wait(std::chrono::duration_cast<std::chrono::nanoseconds>(seconds));
+
+        for (auto *servo : devices) {
+            servo->update_cycle_stats(timer);
+        }
+    }
+}
@@ -0,0 +1,53 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ * Copyright (C) 2024 Håvard F. Aasen <havard.f.aasen@pfft.no>
+ */
+
+/**
+ * @file
+ * @brief Poll every drive connected to one Modbus bus.
+ */
+
+#ifndef LICHUAN_A4_BUS_POLLER_H
+#define LICHUAN_A4_BUS_POLLER_H
+
+#include "cycle_timer.h"
+#include "lichuan_a4.h"
+#include "modbus.h"
+
+#include <atomic>
+#include <vector>
+
+
+/**
+ * @brief Polling loop of one bus.
+ *
+ * Each bus is polled from its own thread, buses on separate serial devices
+ * are independent of each other.
+ */
+class Bus_poller {
+public:
+    explicit Bus_poller(Modbus& _bus) : bus{_bus} {}
+
+    /** Add a drive connected to this bus, must outlive the poller. */
+    void add_device(Lichuan_a4& device) { devices.push_back(&device); }
+
+    [[nodiscard]] Modbus& get_bus() noexcept { return bus; }
+    [[nodiscard]] bool empty() const noexcept { return devices.empty(); }
+    [[nodiscard]] const Lichuan_a4& front() const { return *devices.front(); }
+
+    /**
+     * @brief Poll all drives until @p done is set.
+     *
+     * The first drive on the bus sets the polling frequency. The period is
+     * held with absolute deadlines, so time spent reading don't add to it.
+     */
+    void run(const std::atomic<bool>& done);
+
+private:
+    Modbus& bus;
+    std::vector<Lichuan_a4*> devices{};
+    Cycle_timer timer{};
+};
+
+#endif // LICHUAN_A4_BUS_POLLER_H
@@ -0,0 +1,61 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ * Copyright (C) 2024 Håvard F. Aasen <havard.f.aasen@pfft.no>
+ */
+
+#include "cycle_timer.h"
+
+#include <cerrno>
+
+
+namespace {
+
+constexpr long nanoseconds_per_second {1'000'000'000};
+
+timespec now() noexcept
+{
+    timespec ts{};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts;
+}
+
+std::chrono::nanoseconds to_duration(const timespec& ts) noexcept
+{
+    return std::chrono::seconds{ts.tv_sec} + std::chrono::nanoseconds{ts.tv_nsec};
+}
+
+timespec add(timespec ts, const std::chrono::nanoseconds duration) noexcept
+{
+    const auto ns = ts.tv_nsec + duration.count();
+    ts.tv_sec += static_cast<time_t>(ns / nanoseconds_per_second);
+    ts.tv_nsec = static_cast<long>(ns % nanoseconds_per_second);
+    return ts;
+}
+
+} // namespace
+
+
+void Cycle_timer::start() noexcept
+{
+    deadline = now();
+    last_wakeup = deadline;
+}
+
+void Cycle_timer::wait(const std::chrono::nanoseconds period) noexcept
+{
+    deadline = add(deadline, period);
+
+    const timespec current = now();
+    if (to_duration(current) >= to_duration(deadline)) {
+        // Skip missed deadlines, start a new period from now.
+        overrun_count++;
+        deadline = current;
+    } else {
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, nullptr) == EINTR) {}
+    }
+
+    const timespec wakeup = now();
+    actual_period = to_duration(wakeup) - to_duration(last_wakeup);
+    period_jitter = actual_period > period ? actual_period - period : period - actual_period;
+    last_wakeup = wakeup;
+}
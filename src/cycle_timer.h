@@ -0,0 +1,53 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ * Copyright (C) 2024 Håvard F. Aasen <havard.f.aasen@pfft.no>
+ */
+
+/**
+ * @file
+ * @brief Periodic timer with absolute deadlines.
+ */
+
+#ifndef LICHUAN_A4_CYCLE_TIMER_H
+#define LICHUAN_A4_CYCLE_TIMER_H
+
+#include <chrono>
+#include <cstdint>
+#include <ctime>
+
+
+/**
+ * @brief Hold a fixed period, independent of the time spent in each cycle.
+ *
+ * Deadlines are absolute times on @c CLOCK_MONOTONIC, so the period don't
+ * drift with the work done in each cycle. If the work takes longer than the
+ * period, the cycle is counted as an overrun, and the missed deadlines are
+ * skipped instead of running several cycles back to back.
+ */
+class Cycle_timer {
+public:
+    /** Start the first period now. */
+    void start() noexcept;
+
+    /**
+     * @brief Sleep until the end of the current period.
+     * @param period Length of the current period, may change between cycles.
+     */
+    void wait(std::chrono::nanoseconds period) noexcept;
+
+    /** Measured time between the last two wake-ups. */
+    [[nodiscard]] std::chrono::nanoseconds period() const noexcept { return actual_period; }
+    /** Difference between the last measured period and the requested period. */
+    [[nodiscard]] std::chrono::nanoseconds jitter() const noexcept { return period_jitter; }
+    /** Number of cycles which ended after their deadline. */
+    [[nodiscard]] uint32_t overruns() const noexcept { return overrun_count; }
+
+private:
+    timespec deadline{};
+    timespec last_wakeup{};
+    std::chrono::nanoseconds actual_period{};
+    std::chrono::nanoseconds period_jitter{};
+    uint32_t overrun_count{};
+};
+
+#endif // LICHUAN_A4_CYCLE_TIMER_H
@@ -0,0 +1,61 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ * Copyright (C) 2024 Håvard F. Aasen <havard.f.aasen@pfft.no>
+ */
+
+#include "drive_health.h"
+
+#include <algorithm>
+
+
+bool Drive_health::record(const bool success, const clock::time_point now) noexcept
+{
+    const State old = state;
+    if (success) {
+        failures = 0;
+        probe_interval = min_probe_interval;
+        change_state(State::online);
+        return state != old;
+    }
+
+    failures++;
+    switch (state) {
+        case State::online:
+            change_state(State::degraded);
+            break;
+        case State::degraded:
+            if (failures >= offline_threshold) {
+                change_state(State::offline);
+                next_probe = now + probe_interval;
+            }
+            break;
+        case State::offline:
+            probe_interval = std::min(probe_interval * 2, max_probe_interval);
+            next_probe = now + probe_interval;
+            break;
+    }
+    return state != old;
+}
+
+bool Drive_health::poll_due(const clock::time_point now) const noexcept
+{
+    return state != State::offline || now >= next_probe;
+}
+
+void Drive_health::change_state(const State next) noexcept
+{
+    if (next == state)
+        return;
+    state = next;
+    transition_count++;
+}
+
+const char* Drive_health::state_name(const State state) noexcept
+{
+    switch (state) {
+        case State::online: return "online";
+        case State::degraded: return "degraded";
+        case State::offline: return "offline";
+    }
+    return "unknown";
+}
@@ -0,0 +1,71 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ * Copyright (C) 2024 Håvard F. Aasen <havard.f.aasen@pfft.no>
+ */
+
+/**
+ * @file
+ * @brief Health of the Modbus connection to one drive.
+ */
+
+#ifndef LICHUAN_A4_DRIVE_HEALTH_H
+#define LICHUAN_A4_DRIVE_HEALTH_H
+
+#include <chrono>
+#include <cstdint>
+
+
+/**
+ * @brief Circuit breaker for one drive.
+ *
+ * A drive which stops responding would make every read wait for the full
+ * response timeout, with retries, and starve the other drives on the same
+ * bus. After the first failure the drive is degraded and get no retries.
+ * After @ref offline_threshold consecutive failures it is offline, and is
+ * only probed, with an exponentially increasing interval, until it responds.
+ */
+class Drive_health {
+public:
+    using clock = std::chrono::steady_clock;
+
+    enum class State {
+        online,     /*!< responding */
+        degraded,   /*!< recent failure, no retries */
+        offline,    /*!< not responding, only probed */
+    };
+
+    /** Consecutive failures before a drive is offline. */
+    static constexpr int offline_threshold {3};
+    static constexpr std::chrono::milliseconds min_probe_interval {250};
+    static constexpr std::chrono::milliseconds max_probe_interval {8'000};
+
+    /**
+     * @brief Record the result of a transaction, after any retries.
+     * @return @c true if the state changed.
+     */
+    bool record(bool success, clock::time_point now) noexcept;
+
+    /** If the drive should be polled, or probed when offline. */
+    [[nodiscard]] bool poll_due(clock::time_point now) const noexcept;
+
+    /** Number of attempts of each transaction, in the current state. */
+    [[nodiscard]] int attempts(int retries) const noexcept { return state == State::online ? retries : 1; }
+
+    [[nodiscard]] State get_state() const noexcept { return state; }
+    [[nodiscard]] bool online() const noexcept { return state != State::offline; }
+    /** Number of state changes. */
+    [[nodiscard]] uint32_t transitions() const noexcept { return transition_count; }
+
+    [[nodiscard]] static const char* state_name(State state) noexcept;
+
+private:
+    State state{State::online};
+    int failures{};     /*!< consecutive failures */
+    uint32_t transition_count{};
+    std::chrono::milliseconds probe_interval{min_probe_interval};
+    clock::time_point next_probe{};
+
+    void change_state(State next) noexcept;
+};
+
+#endif // LICHUAN_A4_DRIVE_HEALTH_H
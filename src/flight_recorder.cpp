@@ -0,0 +1,115 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ * Copyright (C) 2024 Håvard F. Aasen <havard.f.aasen@pfft.no>
+ */
+
+#include "flight_recorder.h"
+
+#include <algorithm>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iomanip>
+
+
+void Flight_recorder::record(const Rtu_master::Status status, const std::chrono::nanoseconds latency,
+                             const uint8_t *request, const std::size_t request_length,
+                             const uint8_t *response, const std::size_t response_length) noexcept
+{
+    const uint64_t index = head.load(std::memory_order_relaxed);
+    Slot& slot = slots[index % capacity];
+
+    Record record{};
+    record.timestamp = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+    record.latency = static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::microseconds>(latency).count());
+    record.status = status;
+    record.request_length = static_cast<uint16_t>(std::min(request_length, max_frame_size));
+    record.response_length = static_cast<uint16_t>(std::min(response_length, max_frame_size));
+    std::memcpy(record.request.data(), request, record.request_length);
+    std::memcpy(record.response.data(), response, record.response_length);
+    std::array<uint64_t, record_words> words{};
+    std::memcpy(words.data(), &record, sizeof(record));
+
+    // The slot is only odd while it is stored, the record is built before.
+    const uint32_t sequence = slot.sequence.load(std::memory_order_relaxed);
+    slot.sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    for (std::size_t i = 0; i < record_words; i++)
+        slot.words[i].store(words[i], std::memory_order_relaxed);
+
+    slot.sequence.store(sequence + 2, std::memory_order_release);
+    head.store(index + 1, std::memory_order_release);
+
+    if (status != Rtu_master::Status::done) {
+        const auto now = std::chrono::steady_clock::now();
+        if (!had_error || now - last_error >= healthy_period)
+            trigger.store(true, std::memory_order_release);
+        had_error = true;
+        last_error = now;
+    }
+}
+
+bool Flight_recorder::dump(const std::string& path, const std::string& device, const char *reason) const
+{
+    std::ofstream os{path, std::ios::app};
+    if (!os)
+        return false;
+
+    const auto now = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
+    std::tm tm{};
+    localtime_r(&now, &tm);
+    os << "# " << std::put_time(&tm, "%F %T") << " " << device << ": " << reason << "\n";
+
+    const uint64_t end = head.load(std::memory_order_acquire);
+    const uint64_t begin = end > capacity ? end - capacity : 0;
+    for (uint64_t i = begin; i < end; i++) {
+        const Slot& slot = slots[i % capacity];
+        const uint32_t before = slot.sequence.load(std::memory_order_acquire);
+        if (before & 1U)
+            continue;
+        std::array<uint64_t, record_words> words{};
+        for (std::size_t word = 0; word < record_words; word++)
+            words[word] = slot.words[word].load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        // Overwritten while copying.
+        if (slot.sequence.load(std::memory_order_relaxed) != before)
+            continue;
+        Record record{};
+        std::memcpy(static_cast<void*>(&record), words.data(), sizeof(record));
+        print_record(os, record);
+    }
+    os << "\n";
+    return static_cast<bool>(os);
+}
+
+void Flight_recorder::print_record(std::ostream& os, const Record& record)
+{
+    const auto seconds = static_cast<std::time_t>(record.timestamp / 1'000'000'000);
+    std::tm tm{};
+    localtime_r(&seconds, &tm);
+    os << std::put_time(&tm, "%T") << "." << std::setfill('0') << std::setw(6)
+       << (record.timestamp % 1'000'000'000) / 1000 << std::setfill(' ');
+
+    // Request is target, function, address and count or value.
+    if (record.request_length >= 6) {
+        const uint8_t *req = record.request.data();
+        const int function = req[1];
+        os << " target=" << static_cast<int>(req[0]) << " function=0x" << std::hex << std::setw(2)
+           << std::setfill('0') << function << std::dec << std::setfill(' ')
+           << " address=" << ((req[2] << 8) | req[3])
+           << " count=" << (function == Rtu_master::write_single_register ? 1 : (req[4] << 8) | req[5]);
+    }
+    os << " result=" << Rtu_master::status_message(record.status)
+       << " latency=" << record.latency << "us";
+
+    auto print_bytes = [&os](const char *label, const uint8_t *data, const std::size_t length) {
+        os << " " << label << "=";
+        for (std::size_t i = 0; i < length; i++)
+            os << std::hex << std::setw(2) << std::setfill('0') << static_cast<int>(data[i]);
+        os << std::dec << std::setfill(' ');
+    };
+    print_bytes("tx", record.request.data(), record.request_length);
+    print_bytes("rx", record.response.data(), record.response_length);
+    os << "\n";
+}
@@ -0,0 +1,94 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ * Copyright (C) 2024 Håvard F. Aasen <havard.f.aasen@pfft.no>
+ */
+
+/**
+ * @file
+ * @brief Ring buffer of the most recent Modbus transactions.
+ */
+
+#ifndef LICHUAN_A4_FLIGHT_RECORDER_H
+#define LICHUAN_A4_FLIGHT_RECORDER_H
+
+#include "rtu_master.h"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <type_traits>
+
+
+/**
+ * @brief Record the last transactions on a bus, to diagnose intermittent faults.
+ *
+ * Written by the polling thread without locks or memory allocation. Each slot
+ * has a sequence number which is odd while the slot is written, so a reader
+ * in another thread can skip slots which change while being copied. The
+ * record is stored as relaxed atomic words, so a copy which overlaps a write
+ * is a torn value which is thrown away, not a data race.
+ */
+class Flight_recorder {
+public:
+    static constexpr std::size_t capacity {256};
+    /** Errors after this long without errors trigger a dump. */
+    static constexpr std::chrono::seconds healthy_period {10};
+
+    /**
+     * @brief Record a transaction.
+     *
+     * Only called from the thread owning the bus.
+     */
+    void record(Rtu_master::Status status, std::chrono::nanoseconds latency,
+                const uint8_t *request, std::size_t request_length,
+                const uint8_t *response, std::size_t response_length) noexcept;
+
+    /**
+     * @brief Check if the recorder wants to be dumped, and clear the request.
+     *
+     * Set on the first error after a period without errors.
+     */
+    [[nodiscard]] bool take_trigger() noexcept { return trigger.exchange(false, std::memory_order_acq_rel); }
+
+    /**
+     * @brief Append the recorded transactions to @p path, oldest first.
+     * @return @c true on success.
+     */
+    bool dump(const std::string& path, const std::string& device, const char *reason) const;
+
+private:
+    /** Largest RTU frame. */
+    static constexpr std::size_t max_frame_size {256};
+
+    struct Record {
+        int64_t timestamp{};            /*!< wall clock time [ns since epoch] */
+        uint32_t latency{};             /*!< [us] */
+        Rtu_master::Status status{};
+        uint16_t request_length{};
+        uint16_t response_length{};
+        std::array<uint8_t, max_frame_size> request{};
+        std::array<uint8_t, max_frame_size> response{};
+    };
+
+    static_assert(std::is_trivially_copyable_v<Record>, "Record is copied as words");
+    static constexpr std::size_t record_words {(sizeof(Record) + sizeof(uint64_t) - 1) / sizeof(uint64_t)};
+    static_assert(std::atomic<uint64_t>::is_always_lock_free, "Slot must not take a lock");
+
+    struct Slot {
+        std::atomic<uint32_t> sequence{};
+        std::array<std::atomic<uint64_t>, record_words> words{};
+    };
+
+    std::array<Slot, capacity> slots{};
+    std::atomic<uint64_t> head{};       /*!< number of transactions recorded */
+    std::atomic<bool> trigger{false};
+    std::chrono::steady_clock::time_point last_error{};
+    bool had_error{false};
+
+    static void print_record(std::ostream& os, const Record& record);
+};
+
+#endif // LICHUAN_A4_FLIGHT_RECORDER_H
@@ -7,8 +7,14 @@
 
 #include <iostream>
 #include <sstream>
+#include <type_traits>
 #include <utility>
 
+static_assert(std::is_same_v<pin_bit_t, hal_bit_t>, "Pin types must match HAL");
+static_assert(std::is_same_v<pin_float_t, hal_float_t>, "Pin types must match HAL");
+static_assert(std::is_same_v<pin_u32_t, hal_u32_t>, "Pin types must match HAL");
+static_assert(std::is_same_v<pin_s32_t, hal_s32_t>, "Pin types must match HAL");
+
 
 HAL::HAL(std::string_view _hal_name) : hal_name{_hal_name}
 {
@@ -19,8 +25,8 @@ HAL::HAL(std::string_view _hal_name) : hal_name{_hal_name}
         throw std::runtime_error(oss.str());
     }
 
-    data = static_cast<Data*>(hal_malloc(sizeof(Data)));
-    if (!data) {
+    hal_data = static_cast<Pin_data*>(hal_malloc(sizeof(Pin_data)));
+    if (!hal_data) {
         std::ostringstream oss;
         oss << hal_name << ": ERROR: Unable to allocate shared memory\n";
         throw std::runtime_error(oss.str());
@@ -34,7 +40,7 @@ HAL::HAL(std::string_view _hal_name) : hal_name{_hal_name}
         throw std::runtime_error(oss.str());
     }
 
-    initialize_data();
+    initialize_data(*hal_data);
     hal_ready(hal_comp_id);
 }
 
@@ -43,7 +49,7 @@ HAL::HAL(HAL&& rhs) noexcept
     hal_comp_id = rhs.hal_comp_id;
     rhs.hal_comp_id = 0;
     hal_name = std::move(rhs.hal_name);
-    data = std::exchange(rhs.data, nullptr);
+    hal_data = std::exchange(rhs.hal_data, nullptr);
 }
 
 HAL& HAL::operator=(HAL&& rhs) noexcept
@@ -53,7 +59,7 @@ HAL& HAL::operator=(HAL&& rhs) noexcept
     hal_comp_id = rhs.hal_comp_id;
     rhs.hal_comp_id = 0;
     hal_name = std::move(rhs.hal_name);
-    data = std::exchange(rhs.data, nullptr);
+    hal_data = std::exchange(rhs.hal_data, nullptr);
     return *this;
 }
 
@@ -70,70 +76,73 @@ bool HAL::create_hal_pins() const noexcept
 {
     const char *name = this->hal_name.c_str();
 
-    if (hal_pin_float_newf(HAL_OUT, &data->commanded_speed, hal_comp_id, "%s.commanded-speed", name) != 0) return false;
-    if (hal_pin_float_newf(HAL_OUT, &data->feedback_speed, hal_comp_id, "%s.feedback-speed", name) != 0) return false;
-    if (hal_pin_float_newf(HAL_OUT, &data->deviation_speed, hal_comp_id, "%s.deviation-speed", name) != 0) return false;
-    if (hal_pin_float_newf(HAL_OUT, &data->commanded_torque, hal_comp_id, "%s.commanded-torque", name) != 0) return false;
-    if (hal_pin_float_newf(HAL_OUT, &data->feedback_torque, hal_comp_id, "%s.feedback-torque", name) != 0) return false;
-    if (hal_pin_float_newf(HAL_OUT, &data->deviation_torque, hal_comp_id, "%s.deviation-torque", name) != 0) return false;
-    if (hal_pin_float_newf(HAL_OUT, &data->dc_bus_volt, hal_comp_id, "%s.dc-bus-volt", name) != 0) return false;
-    if (hal_pin_float_newf(HAL_OUT, &data->torque_load, hal_comp_id, "%s.torque-load", name) != 0) return false;
-    if (hal_pin_float_newf(HAL_OUT, &data->res_braking, hal_comp_id, "%s.res-braking", name) != 0) return false;
-    if (hal_pin_float_newf(HAL_OUT, &data->torque_overload, hal_comp_id, "%s.torque-overload", name) != 0) return false;
-    if (hal_pin_s32_newf(HAL_OUT, &data->error_code, hal_comp_id, "%s.error-code", name) != 0) return false;
-
-    if (hal_pin_bit_newf(HAL_OUT, &data->digital_in0, hal_comp_id, "%s.servo-enabling", name) != 0) return false;
-    if (hal_pin_bit_newf(HAL_OUT, &data->digital_in1, hal_comp_id, "%s.clear-alarm", name) != 0) return false;
-    if (hal_pin_bit_newf(HAL_OUT, &data->digital_in2, hal_comp_id, "%s.clockwise-stroke-limit", name) != 0) return false;
-    if (hal_pin_bit_newf(HAL_OUT, &data->digital_in3, hal_comp_id, "%s.anticlockwise-stroke-limit", name) != 0) return false;
-    if (hal_pin_bit_newf(HAL_OUT, &data->digital_in4, hal_comp_id, "%s.clear-deviation-counter", name) != 0) return false;
-    if (hal_pin_bit_newf(HAL_OUT, &data->digital_in5, hal_comp_id, "%s.pulse-prohibition", name) != 0) return false;
-    if (hal_pin_bit_newf(HAL_OUT, &data->digital_in6, hal_comp_id, "%s.torque-limit-switchover", name) != 0) return false;
-    if (hal_pin_bit_newf(HAL_OUT, &data->digital_in7, hal_comp_id, "%s.homing", name) != 0) return false;
-
-    if (hal_pin_bit_newf(HAL_OUT, &data->digital_out0, hal_comp_id, "%s.servo-ready", name) != 0) return false;
-    if (hal_pin_bit_newf(HAL_OUT, &data->digital_out1, hal_comp_id, "%s.active-alarm", name) != 0) return false;
-    if (hal_pin_bit_newf(HAL_OUT, &data->digital_out2, hal_comp_id, "%s.location-arrival", name) != 0) return false;
-    if (hal_pin_bit_newf(HAL_OUT, &data->digital_out3, hal_comp_id, "%s.brake", name) != 0) return false;
-    if (hal_pin_bit_newf(HAL_OUT, &data->digital_out4, hal_comp_id, "%s.zero-speed", name) != 0) return false;
-    if (hal_pin_bit_newf(HAL_OUT, &data->digital_out5, hal_comp_id, "%s.torque-limiting", name) != 0) return false;
+    // Registers of the drive
+    for (std::size_t i = 0; i < register_map::fields.size(); i++) {
+        const auto& field = register_map::fields[i];
+        const std::size_t index = register_map::index_of(i);
+        const int result = field.type == register_map::Pin_type::bit_pin
+                ? hal_pin_bit_newf(HAL_OUT, &hal_data->bits[index], hal_comp_id, "%s.%s", name, field.pin)
+                : hal_pin_float_newf(HAL_OUT, &hal_data->numbers[index], hal_comp_id, "%s.%s", name, field.pin);
+        if (result != 0) return false;
+    }
+
+    if (hal_pin_s32_newf(HAL_OUT, &hal_data->error_code, hal_comp_id, "%s.error-code", name) != 0) return false;
+    if (hal_pin_u32_newf(HAL_OUT, &hal_data->sequence, hal_comp_id, "%s.sequence", name) != 0) return false;
+    if (hal_pin_bit_newf(HAL_OUT, &hal_data->online, hal_comp_id, "%s.online", name) != 0) return false;
+
+    if (hal_pin_float_newf(HAL_OUT, &hal_data->cycle_period, hal_comp_id, "%s.cycle-period", name) != 0) return false;
+    if (hal_pin_float_newf(HAL_OUT, &hal_data->cycle_jitter, hal_comp_id, "%s.cycle-jitter", name) != 0) return false;
+    if (hal_pin_u32_newf(HAL_OUT, &hal_data->cycle_overruns, hal_comp_id, "%s.cycle-overruns", name) != 0) return false;
+
+    if (!create_latency_pins(hal_data->speed_latency, "speed")) return false;
+    if (!create_latency_pins(hal_data->torque_latency, "torque")) return false;
+    if (!create_latency_pins(hal_data->digital_IO_latency, "digital-io")) return false;
+    if (!create_latency_pins(hal_data->monitor_latency, "monitor")) return false;
+
+    for (std::size_t i = 0; i < hal_data->alarms.size(); i++) {
+        if (!create_alarm_pins(hal_data->alarms[i], i)) return false;
+    }
+    if (hal_pin_u32_newf(HAL_OUT, &hal_data->alarm_count, hal_comp_id, "%s.alarm-count", name) != 0) return false;
 
     // FIXME: If multiple devices, the 'modbus_polling' pin should be shared between all devices.
-    if (hal_param_float_newf(HAL_RW, &data->modbus_polling, hal_comp_id, "%s.modbus-polling", name) != 0) return false;
-    if (hal_param_u32_newf(HAL_RO, &data->modbus_errors, hal_comp_id, "%s.modbus-errors", name) != 0) return false;
+    if (hal_param_float_newf(HAL_RW, &hal_data->modbus_polling, hal_comp_id, "%s.modbus-polling", name) != 0) return false;
+    if (hal_param_float_newf(HAL_RW, &hal_data->speed_polling, hal_comp_id, "%s.speed-polling", name) != 0) return false;
+    if (hal_param_float_newf(HAL_RW, &hal_data->torque_polling, hal_comp_id, "%s.torque-polling", name) != 0) return false;
+    if (hal_param_float_newf(HAL_RW, &hal_data->digital_IO_polling, hal_comp_id, "%s.digital-io-polling", name) != 0) return false;
+    if (hal_param_float_newf(HAL_RW, &hal_data->monitor_polling, hal_comp_id, "%s.monitor-polling", name) != 0) return false;
+    if (hal_param_bit_newf(HAL_RW, &hal_data->monitor_enable, hal_comp_id, "%s.monitor-enable", name) != 0) return false;
+    if (hal_param_u32_newf(HAL_RO, &hal_data->modbus_errors, hal_comp_id, "%s.modbus-errors", name) != 0) return false;
+    if (hal_param_u32_newf(HAL_RO, &hal_data->write_errors, hal_comp_id, "%s.write-errors", name) != 0) return false;
+    if (hal_param_u32_newf(HAL_RO, &hal_data->health_transitions, hal_comp_id, "%s.health-transitions", name) != 0) return false;
+    if (hal_param_u32_newf(HAL_RO, &hal_data->reconnects, hal_comp_id, "%s.reconnects", name) != 0) return false;
+    if (hal_param_float_newf(HAL_RO, &hal_data->response_timeout, hal_comp_id, "%s.response-timeout", name) != 0) return false;
+    if (hal_param_float_newf(HAL_RO, &hal_data->byte_timeout, hal_comp_id, "%s.byte-timeout", name) != 0) return false;
+    if (hal_param_bit_newf(HAL_RW, &hal_data->latency_reset, hal_comp_id, "%s.latency-reset", name) != 0) return false;
+    if (hal_param_bit_newf(HAL_RW, &hal_data->alarm_dump, hal_comp_id, "%s.alarm-dump", name) != 0) return false;
+
+    return true;
+}
+
+bool HAL::create_latency_pins(Pin_data::Latency& pins, const char *group) const noexcept
+{
+    const char *name = this->hal_name.c_str();
+
+    if (hal_pin_float_newf(HAL_OUT, &pins.p50, hal_comp_id, "%s.%s.latency-p50", name, group) != 0) return false;
+    if (hal_pin_float_newf(HAL_OUT, &pins.p99, hal_comp_id, "%s.%s.latency-p99", name, group) != 0) return false;
+    if (hal_pin_float_newf(HAL_OUT, &pins.max, hal_comp_id, "%s.%s.latency-max", name, group) != 0) return false;
+    if (hal_pin_float_newf(HAL_OUT, &pins.mean, hal_comp_id, "%s.%s.latency-mean", name, group) != 0) return false;
 
     return true;
 }
 
-constexpr void HAL::initialize_data() const noexcept
+bool HAL::create_alarm_pins(Pin_data::Alarm& pins, const std::size_t index) const noexcept
 {
-    *data->commanded_speed = 0;
-    *data->feedback_speed = 0;
-    *data->deviation_speed = 0;
-    *data->commanded_torque = 0;
-    *data->feedback_torque = 0;
-    *data->deviation_torque = 0;
-    *data->dc_bus_volt = 0;
-    *data->torque_load = 0;
-    *data->res_braking = 0;
-    *data->torque_overload = 0;
-    *data->error_code = 0;
-
-    *data->digital_in0 = false;
-    *data->digital_in1 = false;
-    *data->digital_in2 = false;
-    *data->digital_in3 = false;
-    *data->digital_in4 = false;
-    *data->digital_in5 = false;
-    *data->digital_in6 = false;
-    *data->digital_in7 = false;
-    *data->digital_out0 = false;
-    *data->digital_out1 = false;
-    *data->digital_out2 = false;
-    *data->digital_out3 = false;
-    *data->digital_out4 = false;
-    *data->digital_out5 = false;
-
-    data->modbus_polling = 1.0;
-    data->modbus_errors = 0;
+    const char *name = this->hal_name.c_str();
+
+    if (hal_pin_s32_newf(HAL_OUT, &pins.code, hal_comp_id, "%s.alarm.%zu.code", name, index) != 0) return false;
+    if (hal_pin_float_newf(HAL_OUT, &pins.first_seen, hal_comp_id, "%s.alarm.%zu.first-seen", name, index) != 0) return false;
+    if (hal_pin_float_newf(HAL_OUT, &pins.cleared, hal_comp_id, "%s.alarm.%zu.cleared", name, index) != 0) return false;
+    if (hal_pin_float_newf(HAL_OUT, &pins.duration, hal_comp_id, "%s.alarm.%zu.duration", name, index) != 0) return false;
+
+    return true;
 }
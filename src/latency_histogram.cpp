@@ -0,0 +1,72 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ * Copyright (C) 2024 Håvard F. Aasen <havard.f.aasen@pfft.no>
+ */
+
+#include "latency_histogram.h"
+
+#include <algorithm>
+#include <cmath>
+
+
+void Latency_histogram::record(const std::chrono::nanoseconds latency) noexcept
+{
+    const auto us = static_cast<uint64_t>(
+            std::max(std::chrono::duration_cast<std::chrono::microseconds>(latency).count(), 0L));
+    const uint64_t value = std::min(us, max_value);
+    buckets[bucket_index(value)]++;
+    sample_count++;
+    sum_us += us;
+    max_us = std::max(max_us, us);
+}
+
+void Latency_histogram::reset() noexcept
+{
+    buckets.fill(0);
+    sample_count = 0;
+    sum_us = 0;
+    max_us = 0;
+}
+
+std::chrono::microseconds Latency_histogram::percentile(const double fraction) const noexcept
+{
+    if (sample_count == 0)
+        return {};
+
+    const auto rank = static_cast<uint64_t>(std::ceil(std::clamp(fraction, 0.0, 1.0)
+                                                      * static_cast<double>(sample_count)));
+    uint64_t seen = 0;
+    for (std::size_t i = 0; i < bucket_count; i++) {
+        seen += buckets[i];
+        // The last bucket also holds every longer latency, it has no upper limit.
+        if (seen >= rank && seen > 0)
+            return i == bucket_count - 1 ? max() : std::chrono::microseconds{std::min(bucket_upper(i), max_us)};
+    }
+    return max();
+}
+
+std::chrono::microseconds Latency_histogram::mean() const noexcept
+{
+    if (sample_count == 0)
+        return {};
+    return std::chrono::microseconds{sum_us / sample_count};
+}
+
+std::size_t Latency_histogram::bucket_index(const uint64_t value) noexcept
+{
+    // Values below the number of sub-buckets get one bucket each.
+    if (value < sub_buckets)
+        return value;
+    const auto exponent = static_cast<unsigned>(63 - __builtin_clzll(value));
+    const uint64_t sub = (value >> (exponent - sub_bucket_bits)) & (sub_buckets - 1);
+    return sub_buckets * (exponent - sub_bucket_bits + 1) + sub;
+}
+
+uint64_t Latency_histogram::bucket_upper(const std::size_t index) noexcept
+{
+    if (index < sub_buckets)
+        return index;
+    const auto exponent = static_cast<unsigned>(index / sub_buckets) + sub_bucket_bits - 1;
+    const uint64_t sub = index % sub_buckets;
+    return ((sub_buckets + sub + 1) << (exponent - sub_bucket_bits)) - 1;
+}
@@ -0,0 +1,60 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ * Copyright (C) 2024 Håvard F. Aasen <havard.f.aasen@pfft.no>
+ */
+
+/**
+ * @file
+ * @brief Fixed size histogram of transaction latencies.
+ */
+
+#ifndef LICHUAN_A4_LATENCY_HISTOGRAM_H
+#define LICHUAN_A4_LATENCY_HISTOGRAM_H
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+
+/**
+ * @brief Histogram with logarithmic buckets, from 1 us to about 30 s.
+ *
+ * Each power of two is divided into 8 buckets, so a percentile is accurate to
+ * within 12.5%. The maximum and mean is exact. Recording don't allocate
+ * memory.
+ */
+class Latency_histogram {
+public:
+    void record(std::chrono::nanoseconds latency) noexcept;
+    void reset() noexcept;
+
+    /**
+     * @brief Latency which @p fraction of the samples is below.
+     * @param fraction Between 0 and 1, e.g. 0.99 for the 99th percentile.
+     * @return Upper limit of the bucket holding the percentile, never above
+     *         the maximum. The maximum if the percentile is beyond the last
+     *         bucket. Zero if there are no samples.
+     */
+    [[nodiscard]] std::chrono::microseconds percentile(double fraction) const noexcept;
+    [[nodiscard]] std::chrono::microseconds max() const noexcept { return std::chrono::microseconds{max_us}; }
+    [[nodiscard]] std::chrono::microseconds mean() const noexcept;
+    [[nodiscard]] uint64_t count() const noexcept { return sample_count; }
+
+private:
+    static constexpr unsigned sub_bucket_bits {3};
+    static constexpr uint64_t sub_buckets {1U << sub_bucket_bits};
+    static constexpr unsigned max_exponent {24};
+    static constexpr uint64_t max_value {(uint64_t{1} << (max_exponent + 1)) - 1};
+    static constexpr std::size_t bucket_count {sub_buckets * (max_exponent - sub_bucket_bits + 2)};
+
+    std::array<uint32_t, bucket_count> buckets{};
+    uint64_t sample_count{};
+    uint64_t sum_us{};
+    uint64_t max_us{};
+
+    [[nodiscard]] static std::size_t bucket_index(uint64_t value) noexcept;
+    [[nodiscard]] static uint64_t bucket_upper(std::size_t index) noexcept;
+};
+
+#endif // LICHUAN_A4_LATENCY_HISTOGRAM_H
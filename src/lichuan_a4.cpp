@@ -5,27 +5,127 @@
 
 #include "lichuan_a4.h"
 
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <bitset>
+#include <ctime>
+#include <iomanip>
 #include <iostream>
+#include <sstream>
 #include <string>
+#include <utility>
 
 
-Lichuan_a4::Lichuan_a4(std::string_view _hal_name, std::string_view _device, int _target, int _baud_rate, bool _verbose)
+Lichuan_a4::Lichuan_a4(std::string_view _hal_name, std::unique_ptr<Pin_sink> _pins, Modbus& _bus,
+                       int _target, int _max_gap)
     : hal_name{_hal_name}
     , target{_target}
-    , baud_rate{_baud_rate}
-    , verbose{_verbose}
-    , device{_device}
-    , hal{hal_name}
-    , mb_ctx(device, baud_rate, data_bits, parity, stop_bits, target, verbose)
+    , pin_sink{std::move(_pins)}
+    , pins{pin_sink->data()}
+    , bus{_bus}
+    , max_gap{_max_gap}
 {}
 
 void Lichuan_a4::read_data()
 {
-    read_speed_data();
-    read_torque_data();
-    read_digital_IO();
+    const bool dump_requested = alarm_dump_requested.exchange(false);
+    if (pins.alarm_dump || dump_requested) {
+        // Written at once, so the history of drives on other buses is not mixed in.
+        std::ostringstream oss;
+        dump_alarm_history(oss);
+        std::cout << oss.str() << std::flush;
+        pins.alarm_dump = false;
+    }
+
+    poll();
+    // Also when nothing was read, so the pins don't go stale while the drive is offline.
+    publish_bus_state();
+}
+
+void Lichuan_a4::poll()
+{
+    const auto now = std::chrono::steady_clock::now();
+    if (!health.poll_due(now))
+        return;
+    if (!health.online() && !probe(now))
+        return;
+
+    // Writes go first, so a new command is not delayed by a full set of reads.
+    flush_writes();
+
+    // Groups due in the same cycle is folded into the same blocks when possible.
+    const unsigned groups = due_groups(now);
+    if (groups == 0)
+        return;
+    read_plan.plan(register_map::groups, groups, max_gap);
+
+    if (pins.latency_reset) {
+        for (auto& histogram : latency)
+            histogram.reset();
+        pins.latency_reset = false;
+    }
+
+    const auto read_and_decode = [this](const Register_block& block, const unsigned block_groups) {
+        if (!read_block(block, block_groups))
+            return false;
+        for (std::size_t group = 0; group < group_count; group++) {
+            if (block_groups & (1U << group))
+                decode_group(static_cast<Group>(group));
+        }
+        return true;
+    };
+
+    for (const auto& block : read_plan) {
+        unsigned block_groups = 0;
+        for (std::size_t group = 0; group < group_count; group++) {
+            if ((groups & (1U << group)) && block.contains(register_map::groups[group]))
+                block_groups |= 1U << group;
+        }
+        if (read_and_decode(block, block_groups))
+            continue;
+        // Don't wait for the rest of the blocks, if the drive stopped responding.
+        if (!health.online())
+            break;
+        if (bus.last_status() != Rtu_master::Status::exception
+            || std::bitset<group_count>(block_groups).count() < 2)
+            continue;
+
+        // The drive may reject the registers between the groups, so stop merging them.
+        std::cerr << hal_name << ": Drive rejected a read of register " << block.start << " to "
+                  << block.start + block.count - 1 << ", reading each register group on its own\n";
+        max_gap = separate_groups;
+        for (std::size_t group = 0; group < group_count && health.online(); group++) {
+            if (!(block_groups & (1U << group)))
+                continue;
+            const auto& registers_of_group = register_map::groups[group];
+            (void) read_and_decode({registers_of_group.start, registers_of_group.count}, 1U << group);
+        }
+    }
     update_internal_state();
+    publish();
+    publish_alarms();
+
+    for (std::size_t group = 0; group < group_count; group++) {
+        if (groups & (1U << group))
+            publish_latency(static_cast<Group>(group));
+    }
+}
+
+void Lichuan_a4::publish_bus_state() noexcept
+{
+    using seconds = std::chrono::duration<double>;
+    pins.response_timeout = std::chrono::duration_cast<seconds>(bus.response_timeout(target)).count();
+    pins.byte_timeout = std::chrono::duration_cast<seconds>(bus.byte_timeout()).count();
+    pins.reconnects = bus.reconnects();
+}
+
+void Lichuan_a4::update_cycle_stats(const Cycle_timer& timer) noexcept
+{
+    using seconds = std::chrono::duration<double>;
+    *pins.cycle_period = std::chrono::duration_cast<seconds>(timer.period()).count();
+    *pins.cycle_jitter = std::chrono::duration_cast<seconds>(timer.jitter()).count();
+    *pins.cycle_overruns = timer.overruns();
 }
 
 Error_code Lichuan_a4::get_current_error() const noexcept
@@ -33,7 +133,7 @@ Error_code Lichuan_a4::get_current_error() const noexcept
     return error_code;
 }
 
-constexpr std::string_view Lichuan_a4::get_error_message(Error_code error_code) noexcept
+std::string_view Lichuan_a4::get_error_message(Error_code error_code) noexcept
 {
     switch (error_code) {
         case Error_code::system_error: return "system error";
@@ -61,92 +161,255 @@ constexpr std::string_view Lichuan_a4::get_error_message(Error_code error_code)
     }
 }
 
-void Lichuan_a4::read_speed_data()
+double Lichuan_a4::group_polling(const Group group) const noexcept
 {
-    for (int retries = 0; retries < modbus_retries; retries++) {
-        const auto data = mb_ctx.read_registers(speed_start_reg, speed_reg_count);
+    switch (group) {
+        case register_map::speed_group: return pins.speed_polling;
+        case register_map::torque_group: return pins.torque_polling;
+        case register_map::digital_IO_group: return pins.digital_IO_polling;
+        case register_map::monitor_group: return pins.monitor_polling;
+        case register_map::group_count: break;
+    }
+    return 0.0;
+}
 
-        if (data.size() == speed_reg_count) {
-            // Speed values can be negative.
-            *hal.data->commanded_speed = static_cast<int16_t>(data[0]);
-            *hal.data->feedback_speed = static_cast<int16_t>(data[1]);
-            *hal.data->deviation_speed = static_cast<int16_t>(data[2]);
-            return;
+unsigned Lichuan_a4::due_groups(const std::chrono::steady_clock::time_point now) noexcept
+{
+    using duration = std::chrono::steady_clock::duration;
+    unsigned groups = 0;
+    for (std::size_t group = 0; group < group_count; group++) {
+        auto& next = next_read[group];
+        if (now < next)
+            continue;
+        if (group == register_map::monitor_group && !pins.monitor_enable)
+            continue;
+
+        groups |= 1U << group;
+        const auto period = std::chrono::duration_cast<duration>(
+                std::chrono::duration<double>(std::max(group_polling(static_cast<Group>(group)), 0.0)));
+        if (next == std::chrono::steady_clock::time_point{}) {
+            // Read everything at start-up, then continue with this drives phase.
+            next = now + std::chrono::duration_cast<duration>(period * phase);
+        } else {
+            next += period;
         }
-        hal.data->modbus_errors++;
+        // Don't try to catch up after a stall, and read every cycle if the
+        // period is shorter than the polling cycle.
+        if (next < now)
+            next = now;
     }
+    return groups;
 }
 
-void Lichuan_a4::read_torque_data()
+void Lichuan_a4::flush_writes()
 {
-    for (int retries = 0; retries < modbus_retries; retries++) {
-        const auto data = mb_ctx.read_registers(torque_start_reg, torque_reg_count);
+    if (writes.pending() == 0)
+        return;
+    const auto result = writes.flush(bus, target, max_write_transactions);
+    pins.write_errors += static_cast<uint32_t>(result.failures);
+    if (result.given_up > 0)
+        std::cerr << hal_name << ": ERROR: Gave up writing " << result.given_up << " registers\n";
+}
 
-        if (data.size() == torque_reg_count) {
-            *hal.data->commanded_torque = data[0] / 10.0;
-            *hal.data->feedback_torque = data[1] / 10.0;
-            *hal.data->deviation_torque = data[2] / 10.0;
-            return;
+bool Lichuan_a4::read_block(const Register_block& block, const unsigned groups)
+{
+    uint16_t *dest = &registers[static_cast<std::size_t>(block.start - register_map::first_reg)];
+    const int attempts = health.attempts(modbus_retries);
+    for (int attempt = 0; attempt < attempts; attempt++) {
+        const auto start = std::chrono::steady_clock::now();
+        const bool success = bus.read_registers(target, block.start, dest, block.count);
+        const auto elapsed = std::chrono::steady_clock::now() - start;
+
+        // Every group in the block shares the cost of the transaction.
+        for (std::size_t group = 0; group < group_count; group++) {
+            if (groups & (1U << group))
+                latency[group].record(elapsed);
+        }
+        if (success) {
+            update_health(true, start);
+            return true;
+        }
+        pins.modbus_errors++;
+        // The drive rejected the request, it would only do so again.
+        if (bus.last_status() == Rtu_master::Status::exception) {
+            update_health(true, start);
+            return false;
         }
-        hal.data->modbus_errors++;
     }
+    update_health(false, std::chrono::steady_clock::now());
+    return false;
 }
 
-void Lichuan_a4::read_digital_IO()
+bool Lichuan_a4::probe(const std::chrono::steady_clock::time_point now)
 {
-    for (int retries = 0; retries < modbus_retries; retries++) {
-        const auto data = mb_ctx.read_registers(digital_IO_start_reg, digital_IO_reg_count);
+    std::array<uint16_t, single_register_count> data{};
+    const bool success = bus.read_registers(target, probe_reg, data);
+    if (!success)
+        pins.modbus_errors++;
+    // An exception is an answer, the drive is back even if it rejected the read.
+    const bool responded = success || bus.last_status() == Rtu_master::Status::exception;
+    update_health(responded, now);
+    return responded;
+}
 
-        if (data.size() == digital_IO_reg_count) {
-            const std::bitset<8> bits_in{data[0]};
-            *hal.data->digital_in0 = bits_in[0];
-            *hal.data->digital_in1 = bits_in[1];
-            *hal.data->digital_in2 = bits_in[2];
-            *hal.data->digital_in3 = bits_in[3];
-            *hal.data->digital_in4 = bits_in[4];
-            *hal.data->digital_in5 = bits_in[5];
-            *hal.data->digital_in6 = bits_in[6];
-            *hal.data->digital_in7 = bits_in[7];
+void Lichuan_a4::update_health(const bool success, const std::chrono::steady_clock::time_point now)
+{
+    const bool was_online = health.online();
+    if (health.record(success, now)) {
+        pins.health_transitions = health.transitions();
+        if (health.online() != was_online)
+            std::cerr << hal_name << ": Drive is " << Drive_health::state_name(health.get_state()) << "\n";
+    }
+    if (*pins.online != health.online())
+        *pins.online = health.online();
+}
 
-            const std::bitset<8> bits_out{data[1]};
-            *hal.data->digital_out0 = bits_out[0];
-            *hal.data->digital_out1 = bits_out[1];
-            *hal.data->digital_out2 = bits_out[2];
-            *hal.data->digital_out3 = bits_out[3];
-            *hal.data->digital_out4 = bits_out[4];
-            *hal.data->digital_out5 = bits_out[5];
-            return;
-        }
-        hal.data->modbus_errors++;
+void Lichuan_a4::publish_latency(const Group group) noexcept
+{
+    Pin_data::Latency *latency_pins = nullptr;
+    switch (group) {
+        case register_map::speed_group: latency_pins = &pins.speed_latency; break;
+        case register_map::torque_group: latency_pins = &pins.torque_latency; break;
+        case register_map::digital_IO_group: latency_pins = &pins.digital_IO_latency; break;
+        case register_map::monitor_group: latency_pins = &pins.monitor_latency; break;
+        case register_map::group_count: return;
     }
+
+    using seconds = std::chrono::duration<double>;
+    const auto& histogram = latency[group];
+    *latency_pins->p50 = std::chrono::duration_cast<seconds>(histogram.percentile(0.50)).count();
+    *latency_pins->p99 = std::chrono::duration_cast<seconds>(histogram.percentile(0.99)).count();
+    *latency_pins->max = std::chrono::duration_cast<seconds>(histogram.max()).count();
+    *latency_pins->mean = std::chrono::duration_cast<seconds>(histogram.mean()).count();
+}
+
+void Lichuan_a4::decode_group(const Group group) noexcept
+{
+    const auto [number_begin, number_end] = register_map::float_ranges[group];
+    for (std::size_t i = number_begin; i < number_end; i++) {
+        const auto& decoder = register_map::number_decoders[i];
+        const uint32_t raw = (uint32_t{registers[decoder.high]} << decoder.shift)
+                             | (registers[decoder.low] & decoder.low_mask);
+        state.numbers[i] = static_cast<double>((raw ^ decoder.sign_bit) - decoder.sign_bit) * decoder.scale;
+    }
+
+    const auto [bit_begin, bit_end] = register_map::bit_ranges[group];
+    for (std::size_t i = bit_begin; i < bit_end; i++) {
+        const auto& decoder = register_map::bit_decoders[i];
+        state.bits[i] = (registers[decoder.word] >> decoder.bit) & 1U;
+    }
+}
+
+void Lichuan_a4::publish() noexcept
+{
+    // The sequence is odd while the pins are updated, a reader which sees the
+    // same even value before and after reading the pins has a consistent sample.
+    bool updating = false;
+    const auto begin_update = [&] {
+        if (updating)
+            return;
+        *pins.sequence = ++sequence;
+        std::atomic_thread_fence(std::memory_order_release);
+        updating = true;
+    };
+    // Unchanged values is not stored, to leave the cache lines of the reader alone.
+    const auto store = [&](auto *pin, const auto value, const auto old) {
+        if (value == old)
+            return;
+        begin_update();
+        *pin = value;
+    };
+
+    for (std::size_t i = 0; i < state.numbers.size(); i++)
+        store(pins.numbers[i], state.numbers[i], published.numbers[i]);
+    for (std::size_t i = 0; i < state.bits.size(); i++)
+        store(pins.bits[i], state.bits[i], published.bits[i]);
+    store(pins.error_code, state.error_code, published.error_code);
+
+    if (!updating)
+        return;
+    std::atomic_thread_fence(std::memory_order_release);
+    *pins.sequence = ++sequence;
+    published = state;
 }
 
 void Lichuan_a4::update_internal_state()
 {
-    if (*hal.data->digital_out1) {
-        read_error_code();
-        print_error_message();
-    } else {
+    const auto now = std::chrono::steady_clock::now();
+    const bool alarm = state.bits[alarm_bit];
+    if (alarm && !alarm_output) {
+        // Raised at the edge, so the time is right even if the error code can't be read yet.
+        alarms.raise(0, now);
+        alarm_read = Alarm_read::first;
+        alarms_changed = true;
+    } else if (!alarm && alarm_output) {
+        alarms.clear(now);
+        alarm_read = Alarm_read::none;
+        alarms_changed = true;
+        const auto duration = std::chrono::duration_cast<std::chrono::duration<double>>(alarms[0].duration);
+        std::cerr << hal_name << ": Alarm " << alarms[0].code << " cleared after " << duration.count() << " s\n";
+        state.error_code = 0;
         error_code = Error_code::no_error;
     }
+    alarm_output = alarm;
+    alarms.update(now);
+
+    if (alarm_read == Alarm_read::none || !health.online())
+        return;
+    // A failed read is tried again in the next cycle.
+    if (!read_error_code())
+        return;
+    alarms.set_code(state.error_code);
+    alarms_changed = true;
+    alarm_read = alarm_read == Alarm_read::first ? Alarm_read::confirm : Alarm_read::none;
+    print_error_message();
 }
 
-void Lichuan_a4::read_error_code()
+void Lichuan_a4::publish_alarms() noexcept
 {
-    for (int retries = 0; retries < modbus_retries; retries++) {
-        const auto data = mb_ctx.read_registers(current_error_code_reg, single_register_count);
+    using seconds = std::chrono::duration<double>;
+    if (alarms_changed) {
+        const auto since_epoch = [](const std::chrono::system_clock::time_point time) {
+            return std::chrono::duration_cast<seconds>(time.time_since_epoch()).count();
+        };
+        for (std::size_t i = 0; i < alarms.size(); i++) {
+            const auto& entry = alarms[i];
+            auto& alarm_pins = pins.alarms[i];
+            *alarm_pins.code = entry.code;
+            *alarm_pins.first_seen = since_epoch(entry.first_seen);
+            *alarm_pins.cleared = entry.active ? 0.0 : since_epoch(entry.cleared);
+            *alarm_pins.duration = std::chrono::duration_cast<seconds>(entry.duration).count();
+        }
+        *pins.alarm_count = alarms.total();
+        alarms_changed = false;
+    } else if (alarms.active()) {
+        *pins.alarms[0].duration = std::chrono::duration_cast<seconds>(alarms[0].duration).count();
+    }
+}
 
-        if (data.size() == single_register_count) {
-            *hal.data->error_code = data[0];
-            return;
+bool Lichuan_a4::read_error_code()
+{
+    std::array<uint16_t, single_register_count> data{};
+    const int attempts = health.attempts(modbus_retries);
+    for (int attempt = 0; attempt < attempts; attempt++) {
+        if (bus.read_registers(target, current_error_code_reg, data)) {
+            state.error_code = data[0];
+            update_health(true, std::chrono::steady_clock::now());
+            return true;
+        }
+        pins.modbus_errors++;
+        if (bus.last_status() == Rtu_master::Status::exception) {
+            update_health(true, std::chrono::steady_clock::now());
+            return false;
         }
-        hal.data->modbus_errors++;
     }
+    update_health(false, std::chrono::steady_clock::now());
+    return false;
 }
 
 void Lichuan_a4::print_error_message()
 {
-    auto current_error = static_cast<Error_code>(*hal.data->error_code);
+    auto current_error = static_cast<Error_code>(state.error_code);
     // Don't print error message multiple times.
     if (current_error == error_code)
         return;
@@ -155,10 +418,38 @@ void Lichuan_a4::print_error_message()
     std::string_view message = get_error_message(error_code);
     if (message.empty())
         return;
-    std::cerr << hal_name << ": ERROR: " << *hal.data->error_code << "\n\t" << message << "\n";
+    std::cerr << hal_name << ": ERROR: " << state.error_code << "\n\t" << message << "\n";
+}
+
+void Lichuan_a4::dump_alarm_history(std::ostream& os) const
+{
+    const auto print_time = [&os](const std::chrono::system_clock::time_point time) {
+        const auto seconds = std::chrono::system_clock::to_time_t(time);
+        std::tm tm{};
+        localtime_r(&seconds, &tm);
+        os << std::put_time(&tm, "%F %T");
+    };
+
+    os << hal_name << ": " << alarms.total() << " alarms since start";
+    if (alarms.total() > alarms.size())
+        os << ", the last " << alarms.size() << " is kept";
+    os << "\n";
+    for (std::size_t i = 0; i < alarms.size(); i++) {
+        const auto& entry = alarms[i];
+        const auto message = get_error_message(static_cast<Error_code>(entry.code));
+        os << "  " << std::setw(2) << entry.code << " " << (message.empty() ? "unknown" : message) << ": ";
+        print_time(entry.first_seen);
+        if (entry.active) {
+            os << ", active";
+        } else {
+            os << " to ";
+            print_time(entry.cleared);
+        }
+        os << ", " << std::chrono::duration_cast<std::chrono::duration<double>>(entry.duration).count() << " s\n";
+    }
 }
 
 double Lichuan_a4::modbus_polling() const
 {
-    return hal.data->modbus_polling;
+    return pins.modbus_polling;
 }
@@ -13,9 +13,22 @@
 #ifndef LICHUAN_A4_H
 #define LICHUAN_A4_H
 
+#include "alarm_history.h"
+#include "cycle_timer.h"
+#include "drive_health.h"
 #include "modbus.h"
-#include "hal.h"
+#include "latency_histogram.h"
+#include "pin_sink.h"
+#include "register_map.h"
+#include "register_plan.h"
+#include "write_queue.h"
 
+#include <array>
+#include <atomic>
+#include <bitset>
+#include <chrono>
+#include <memory>
+#include <ostream>
 #include <string>
 
 enum class Error_code {
@@ -45,45 +58,156 @@ enum class Error_code {
 
 class Lichuan_a4 {
 public:
-    Lichuan_a4(std::string_view _hal_name, std::string_view _device, int _target, int _baud_rate = 19200, bool _verbose = false);
+    /**
+     * @param _hal_name Name of the HAL component.
+     * @param _pins Where pins and parameters of the drive are published.
+     * @param _bus Modbus bus the drive is connected to, must outlive this object.
+     * @param _target Address of Modbus device to read from.
+     * @param _max_gap Highest number of unused registers read, to merge two
+     *                 register groups into one transaction.
+     */
+    Lichuan_a4(std::string_view _hal_name, std::unique_ptr<Pin_sink> _pins, Modbus& _bus, int _target,
+               int _max_gap = default_max_gap);
 
     void read_data();
+
+    /**
+     * @brief Write @p value to a drive register.
+     *
+     * The write is queued, and sent at the start of the next @ref read_data(),
+     * ahead of the reads. Writes of a value the register already has is
+     * dropped. Must be called from the thread polling the drive.
+     * @return @c false if too many different registers is pending.
+     */
+    bool write_register(int address, uint16_t value) noexcept { return writes.write(address, value); }
+
+    /**
+     * @brief Offset the periodic reads of this drive.
+     *
+     * Drives on the same bus get different phases, so reads of slow register
+     * groups is spread evenly over time instead of all at once.
+     * @param _phase Fraction of the polling period of each group, [0, 1).
+     */
+    void set_phase(double _phase) noexcept { phase = _phase; }
+    /** Publish period, jitter and overruns of the polling cycle. */
+    void update_cycle_stats(const Cycle_timer& timer) noexcept;
+    /**
+     * @brief Print the alarm history on the next @ref read_data().
+     *
+     * Safe to call from any thread, e.g. on a signal to the main thread.
+     */
+    void request_alarm_dump() noexcept { alarm_dump_requested = true; }
+    /** Write the alarm history, newest first, to @p os. */
+    void dump_alarm_history(std::ostream& os) const;
     [[nodiscard]] Error_code get_current_error() const noexcept;
-    [[nodiscard]] static constexpr std::string_view get_error_message(Error_code code) noexcept;
+    [[nodiscard]] static std::string_view get_error_message(Error_code code) noexcept;
     [[nodiscard]] double modbus_polling() const;
+    [[nodiscard]] int get_target() const noexcept { return target; }
+
+    // Modbus settings, hard-coded in servo driver
+    static constexpr int data_bits {8};
+    static constexpr int stop_bits {1};
+    static constexpr char parity {'E'};
+
+    /** Register used to check if a drive responds. */
+    static constexpr int probe_reg {457};
+
+    /**
+     * Default highest number of unused registers read between two register
+     * groups. Only adjacent groups is merged, since the drive may reject a
+     * read of registers which is not documented.
+     */
+    static constexpr int default_max_gap {0};
 
 private:
     std::string hal_name;
     Error_code error_code{Error_code::no_error};
     int target; /*!< address of Modbus device to read from */
-    int baud_rate;
-    bool verbose;
-    std::string device;
-    HAL hal;
-    Modbus mb_ctx;
+    std::unique_ptr<Pin_sink> pin_sink;
+    Pin_data& pins;
+    Modbus& bus;
 
     /** If a modbus transaction fails, retry this many times before giving up. */
     static constexpr int modbus_retries {5};
-
-    // Modbus settings, hard-coded in servo driver
-    static constexpr int data_bits {8};
-    static constexpr int stop_bits {1};
-    static constexpr char parity {'E'};
+    /** Highest number of write requests in one cycle, to leave time for the reads. */
+    static constexpr int max_write_transactions {4};
 
     static constexpr int current_error_code_reg {457};
     static constexpr int single_register_count {1};
-    static constexpr int digital_IO_start_reg {466};
-    static constexpr int digital_IO_reg_count {2};
-    static constexpr int speed_start_reg {448};
-    static constexpr int speed_reg_count {3};
-    static constexpr int torque_start_reg {451};
-    static constexpr int torque_reg_count {3};
-
-    void read_speed_data();
-    void read_torque_data();
-    void read_digital_IO();
+
+    using Group = register_map::Group;
+    static constexpr std::size_t group_count {register_map::group_count};
+    /** Bit field of the servo alarm output. */
+    static constexpr std::size_t alarm_bit {register_map::bit_index("active-alarm")};
+    static_assert(alarm_bit < register_map::bit_count, "Register map has no alarm output");
+
+    /** When each group is due to be read, every group has its own polling period. */
+    std::array<std::chrono::steady_clock::time_point, group_count> next_read{};
+    double phase{};     /*!< offset of the first periodic read, as a fraction of the period */
+
+    /** Local copy of the registers in the register map. */
+    std::array<uint16_t, register_map::register_count> registers{};
+    Register_plan read_plan{};
+    int max_gap;
+    /** Gap which keeps every register group in its own block. */
+    static constexpr int separate_groups {-1};
+    Write_queue writes{};
+    Drive_health health{};
+
+    /** Decoded values of the drive, published to the pins in one step. */
+    struct State {
+        std::array<double, register_map::float_count> numbers{};
+        std::bitset<register_map::bit_count> bits{};
+        int32_t error_code{};
+    };
+    /**
+     * The error code is read on the rising edge of the alarm output, and once
+     * more in the next cycle to confirm it. It is not read while the alarm is
+     * latched.
+     */
+    enum class Alarm_read { none, first, confirm };
+    Alarm_read alarm_read{Alarm_read::none};
+    bool alarm_output{false};   /*!< alarm output in the previous cycle */
+    Alarm_history alarms{};
+    bool alarms_changed{false}; /*!< the history pins is out of date */
+    std::atomic<bool> alarm_dump_requested{false};
+
+    State state{};      /*!< decoded in this cycle */
+    State published{};  /*!< last values stored in the pins */
+    uint32_t sequence{};
+
+    [[nodiscard]] double group_polling(Group group) const noexcept;
+    [[nodiscard]] unsigned due_groups(std::chrono::steady_clock::time_point now) noexcept;
+    /** Transaction latency of each register group. */
+    std::array<Latency_histogram, group_count> latency{};
+
+    /** Read the groups which is due, and publish them. */
+    void poll();
+    /** Publish the timeouts and reconnects of the bus. */
+    void publish_bus_state() noexcept;
+    /** Send the queued writes, at most @ref max_write_transactions of them. */
+    void flush_writes();
+    /**
+     * @brief Check if an offline drive responds again.
+     * @return @c true if the drive responded.
+     */
+    bool probe(std::chrono::steady_clock::time_point now);
+    void update_health(bool success, std::chrono::steady_clock::time_point now);
+    /**
+     * @brief Read @p block into the local copy of the registers.
+     * @param groups Mask of the groups in @p block, which gets the latency recorded.
+     */
+    [[nodiscard]] bool read_block(const Register_block& block, unsigned groups);
+    void publish_latency(Group group) noexcept;
+    /** Decode the registers of @p group into @ref state. */
+    void decode_group(Group group) noexcept;
     void update_internal_state();
-    void read_error_code();
+    /** Store every changed value of @ref state in the pins. */
+    void publish() noexcept;
+    /** Publish the alarm history, only the duration is updated while nothing else changed. */
+    void publish_alarms() noexcept;
+    /** @return @c false if the error code could not be read. */
+    bool read_error_code();
     void print_error_message();
 };
 
@@ -0,0 +1,248 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ * Copyright (C) 2024 Håvard F. Aasen <havard.f.aasen@pfft.no>
+ */
+
+/**
+ * @file
+ * @brief Throughput of the polling cycle against simulated drives, for
+ *        every supported baud rate and a range of drive counts.
+ *
+ * The drives publish to process memory, with the default polling periods.
+ */
+
+#include "lichuan_a4.h"
+#include "memory_pins.h"
+#include "modbus.h"
+#include "slave_simulator.h"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <ctime>
+#include <exception>
+#include <fstream>
+#include <getopt.h>
+#include <iostream>
+#include <list>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+static const char* option_string = "D:d:l:o:r:h";
+static struct option long_options[] = {
+        {"drives",  required_argument,  nullptr, 'D'},
+        {"duration", required_argument, nullptr, 'd'},
+        {"latency", required_argument,  nullptr, 'l'},
+        {"output",  required_argument,  nullptr, 'o'},
+        {"rate",    required_argument,  nullptr, 'r'},
+        {"help",    no_argument,        nullptr, 'h'},
+        {nullptr,   0,                  nullptr, 0}
+};
+
+struct Result {
+    int baud_rate{};
+    int drives{};
+    double seconds{};
+    long cycles{};
+    uint64_t transactions{};    /*!< requests sent by the driver */
+    uint64_t errors{};          /*!< failed read attempts, from the modbus-errors of the drives */
+    uint64_t timeouts{};
+    uint64_t crc_errors{};
+    uint64_t bytes_sent{};      /*!< by the driver */
+    uint64_t bytes_received{};  /*!< by the driver */
+    double cpu_seconds{};       /*!< of the polling thread */
+};
+
+void usage(char *argv[])
+{
+    std::cout << "Usage: " << argv[0] << " [ARGUMENTS]\n"
+              << "\n"
+              << "Measure throughput of the polling cycle against simulated drives.\n"
+              << "\n"
+              << "Optional arguments:\n"
+              << "   -D, --drives <integers> (default: 1,4,8,32)\n"
+              << "       Number of drives on the bus.\n"
+              << "   -d, --duration <seconds> (default: 2)\n"
+              << "       Run each combination of baud rate and drives for at least this long, and\n"
+              << "       at least one cycle.\n"
+              << "   -l, --latency <us> (default: 0)\n"
+              << "       Processing time of the simulated drives.\n"
+              << "   -o, --output <path> (default: 'lichuan_a4_bench.json')\n"
+              << "       Write the results as JSON to <path>.\n"
+              << "   -r, --rate <integers> (default: all supported baud rates)\n"
+              << "       Baud rates to measure.\n"
+              << "   -h, --help\n"
+              << "       Show this help.\n";
+}
+
+static std::vector<int> parse_list(const char *input)
+{
+    std::vector<int> values;
+    std::istringstream iss(input);
+    std::string token;
+    while (std::getline(iss, token, ','))
+        values.push_back(std::atoi(token.c_str()));
+    return values;
+}
+
+static double thread_cpu_time() noexcept
+{
+    timespec ts{};
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return static_cast<double>(ts.tv_sec) + static_cast<double>(ts.tv_nsec) * 1e-9;
+}
+
+static Result run(const int baud_rate, const int drives, const std::chrono::duration<double> duration,
+                  const std::chrono::microseconds latency)
+{
+    Slave_simulator::Options options;
+    options.targets.clear();
+    for (int target = 1; target <= drives; target++)
+        options.targets.push_back(target);
+    options.baud_rate = baud_rate;
+    options.latency = latency;
+
+    Slave_simulator simulator{options};
+    std::atomic<bool> done{false};
+    std::thread slave{[&] { simulator.run(done); }};
+
+    Result result{};
+    result.baud_rate = baud_rate;
+    result.drives = drives;
+    try {
+        Modbus bus{simulator.device(), baud_rate, Lichuan_a4::data_bits, Lichuan_a4::parity,
+                   Lichuan_a4::stop_bits};
+        std::list<Lichuan_a4> servos;
+        std::vector<Pin_data*> pins;
+        for (int target = 1; target <= drives; target++) {
+            auto memory_pins = std::make_unique<Memory_pins>();
+            pins.push_back(&memory_pins->data());
+            servos.emplace_back("bench." + std::to_string(target), std::move(memory_pins), bus, target);
+        }
+
+        const auto start = std::chrono::steady_clock::now();
+        const double cpu_start = thread_cpu_time();
+        while (result.cycles == 0 || std::chrono::steady_clock::now() - start < duration) {
+            for (auto& servo : servos)
+                servo.read_data();
+            result.cycles++;
+        }
+        result.cpu_seconds = thread_cpu_time() - cpu_start;
+        result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        for (const auto *data : pins)
+            result.errors += data->modbus_errors;
+        result.transactions = bus.statistics().transactions;
+        result.timeouts = bus.statistics().timeouts;
+        result.crc_errors = bus.statistics().crc_errors;
+    } catch (...) {
+        done = true;
+        slave.join();
+        throw;
+    }
+
+    done = true;
+    slave.join();
+    result.bytes_sent = simulator.bytes_received();
+    result.bytes_received = simulator.bytes_sent();
+    return result;
+}
+
+static void write_json(std::ostream& out, const std::vector<Result>& results, const std::chrono::microseconds latency)
+{
+    out << "{\n"
+        << "  \"latency_us\": " << latency.count() << ",\n"
+        << "  \"results\": [";
+    for (std::size_t i = 0; i < results.size(); i++) {
+        const auto& r = results[i];
+        out << (i == 0 ? "\n" : ",\n")
+            << "    {\"baud_rate\": " << r.baud_rate
+            << ", \"drives\": " << r.drives
+            << ", \"seconds\": " << r.seconds
+            << ", \"cycles\": " << r.cycles
+            << ", \"transactions\": " << r.transactions
+            << ", \"errors\": " << r.errors
+            << ", \"timeouts\": " << r.timeouts
+            << ", \"crc_errors\": " << r.crc_errors
+            << ", \"bytes_sent\": " << r.bytes_sent
+            << ", \"bytes_received\": " << r.bytes_received
+            << ", \"cycles_per_second\": " << static_cast<double>(r.cycles) / r.seconds
+            << ", \"transactions_per_second\": " << static_cast<double>(r.transactions) / r.seconds
+            << ", \"bytes_per_second\": " << static_cast<double>(r.bytes_sent + r.bytes_received) / r.seconds
+            << ", \"cpu_us_per_cycle\": " << r.cpu_seconds * 1e6 / static_cast<double>(r.cycles)
+            << "}";
+    }
+    out << "\n  ]\n}\n";
+}
+
+int main(int argc, char *argv[])
+{
+    std::vector<int> baud_rates(supported_baud_rates.begin(), supported_baud_rates.end());
+    std::vector<int> drive_counts { 1, 4, 8, 32 };
+    std::chrono::duration<double> duration{2.0};
+    std::chrono::microseconds latency{0};
+    std::string output{"lichuan_a4_bench.json"};
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, option_string, long_options, nullptr)) != -1) {
+        switch (opt) {
+            case 'D':
+                drive_counts = parse_list(optarg);
+                for (const int drives : drive_counts) {
+                    if (drives < 1 || drives > 247) {
+                        std::cerr << "ERROR: Invalid number of drives: [" << drives << "]\n";
+                        exit(-1);
+                    }
+                }
+                break;
+            case 'd':
+                duration = std::chrono::duration<double>{std::atof(optarg)};
+                break;
+            case 'l':
+                latency = std::chrono::microseconds{std::atol(optarg)};
+                break;
+            case 'o':
+                output = optarg;
+                break;
+            case 'r':
+                baud_rates = parse_list(optarg);
+                break;
+            case 'h':
+                usage(argv);
+                exit(0);
+            default:
+                usage(argv);
+                exit(1);
+        }
+    }
+
+    std::vector<Result> results;
+    try {
+        for (const int baud_rate : baud_rates) {
+            for (const int drives : drive_counts) {
+                results.push_back(run(baud_rate, drives, duration, latency));
+                const auto& r = results.back();
+                std::cout << r.baud_rate << " baud, " << r.drives << " drives: "
+                          << static_cast<double>(r.cycles) / r.seconds << " cycles/s, "
+                          << static_cast<double>(r.transactions) / r.seconds << " transactions/s, "
+                          << r.errors << " errors, " << r.timeouts << " timeouts, " << r.crc_errors
+                          << " CRC errors\n";
+            }
+        }
+    } catch (const std::exception& e) {
+        std::cerr << e.what();
+        exit(-1);
+    }
+
+    std::ofstream file{output};
+    write_json(file, results, latency);
+    if (!file) {
+        std::cerr << "ERROR: Unable to write results to '" << output << "'\n";
+        exit(-1);
+    }
+    return 0;
+}
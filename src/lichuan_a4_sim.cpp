@@ -0,0 +1,182 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ * Copyright (C) 2024 Håvard F. Aasen <havard.f.aasen@pfft.no>
+ */
+
+/**
+ * @file
+ * @brief Simulate Lichuan A4 servo drives on a pseudo-terminal, to run the
+ *        driver without hardware.
+ */
+
+#include "slave_simulator.h"
+
+#include <atomic>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <getopt.h>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <unistd.h>
+
+
+static std::atomic<bool> done{false};
+
+static const char* option_string = "b:l:L:r:R:t:h";
+static struct option long_options[] = {
+        {"drive-rate", required_argument, nullptr, 'b'},
+        {"latency", required_argument,  nullptr, 'l'},
+        {"link",    required_argument,  nullptr, 'L'},
+        {"rate",    required_argument,  nullptr, 'r'},
+        {"register", required_argument, nullptr, 'R'},
+        {"target",  required_argument,  nullptr, 't'},
+        {"help",    no_argument,        nullptr, 'h'},
+        {nullptr,   0,                  nullptr, 0}
+};
+
+static void quit(int)
+{
+    done = true;
+}
+
+void usage(char *argv[])
+{
+    std::cout << "Usage: " << argv[0] << " [ARGUMENTS]\n"
+              << "\n"
+              << "Simulate Lichuan A4 servo drives on a pseudo-terminal. The path of the\n"
+              << "pseudo-terminal is printed on start, use it as device for lichuan_a4.\n"
+              << "\n"
+              << "Optional arguments:\n"
+              << "   -b, --drive-rate <target>=<n>[,...]\n"
+              << "       Set the baud rate of a drive, it only answers requests sent at <n> baud.\n"
+              << "       Drives without a rate answer at 'rate', or at any rate when it is 0.\n"
+              << "   -l, --latency <us> (default: 0)\n"
+              << "       Processing time of the drive, before each response.\n"
+              << "   -L, --link <path>\n"
+              << "       Create a symbolic link to the pseudo-terminal at <path>.\n"
+              << "   -r, --rate <n> (default: 0)\n"
+              << "       Delay requests and responses by the time to transmit them at <n> baud.\n"
+              << "       0 respond without delay.\n"
+              << "   -R, --register <address>=<value>[,...]\n"
+              << "       Set the initial value of registers between " << Slave_simulator::first_reg
+              << " and " << Slave_simulator::last_reg << ", or of parameters\n"
+              << "       between " << Slave_simulator::first_param << " and " << Slave_simulator::last_param << ".\n"
+              << "   -t, --target <integers> (default: 1)\n"
+              << "       Modbus targets to respond for.\n"
+              << "   -h, --help\n"
+              << "       Show this help.\n";
+}
+
+static bool parse_int(const std::string& input, int& value)
+{
+    char *end = nullptr;
+    const long result = std::strtol(input.c_str(), &end, 0);
+    if (input.empty() || *end != '\0')
+        return false;
+    value = static_cast<int>(result);
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    Slave_simulator::Options options;
+    std::string link;
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, option_string, long_options, nullptr)) != -1) {
+        std::istringstream iss(optarg ? optarg : "");
+        std::string token;
+        switch (opt) {
+            case 'b':
+                while (std::getline(iss, token, ',')) {
+                    const auto separator = token.find('=');
+                    int target;
+                    int rate;
+                    if (separator == std::string::npos || !parse_int(token.substr(0, separator), target)
+                        || !parse_int(token.substr(separator + 1), rate) || rate <= 0) {
+                        std::cerr << "ERROR: Invalid drive rate: [" << token << "]\n";
+                        exit(-1);
+                    }
+                    options.drive_rates[target] = rate;
+                }
+                break;
+            case 'l': {
+                int latency;
+                if (!parse_int(optarg, latency) || latency < 0) {
+                    std::cerr << "ERROR: Invalid latency: [" << optarg << "]\n";
+                    exit(-1);
+                }
+                options.latency = std::chrono::microseconds{latency};
+                break;
+            }
+            case 'L':
+                link = optarg;
+                break;
+            case 'r':
+                if (!parse_int(optarg, options.baud_rate) || options.baud_rate < 0) {
+                    std::cerr << "ERROR: Invalid baud rate: [" << optarg << "]\n";
+                    exit(-1);
+                }
+                break;
+            case 'R':
+                while (std::getline(iss, token, ',')) {
+                    const auto separator = token.find('=');
+                    int address;
+                    int value;
+                    if (separator == std::string::npos || !parse_int(token.substr(0, separator), address)
+                        || !parse_int(token.substr(separator + 1), value) || value < 0 || value > 0xFFFF) {
+                        std::cerr << "ERROR: Invalid register value: [" << token << "]\n";
+                        exit(-1);
+                    }
+                    options.registers[address] = static_cast<uint16_t>(value);
+                }
+                break;
+            case 't':
+                options.targets.clear();
+                while (std::getline(iss, token, ',')) {
+                    int target;
+                    if (!parse_int(token, target)) {
+                        std::cerr << "ERROR: Invalid input in 'target' option: [" << token << "]\n";
+                        exit(-1);
+                    }
+                    options.targets.push_back(target);
+                }
+                break;
+            case 'h':
+                usage(argv);
+                exit(0);
+            default:
+                usage(argv);
+                exit(1);
+        }
+    }
+
+    try {
+        Slave_simulator simulator{options};
+
+        if (!link.empty()) {
+            ::unlink(link.c_str());
+            if (::symlink(simulator.device().c_str(), link.c_str()) != 0) {
+                std::perror("ERROR: Can't create link to pseudo-terminal");
+                exit(-1);
+            }
+        }
+        std::cout << simulator.device() << std::endl;
+
+        signal(SIGINT, quit);
+        signal(SIGTERM, quit);
+        simulator.run(done);
+
+        if (!link.empty())
+            ::unlink(link.c_str());
+        std::cout << simulator.responses() << " responses, " << simulator.bytes_received() << " bytes received, "
+                  << simulator.bytes_sent() << " bytes sent\n";
+    } catch (const std::exception& e) {
+        std::cerr << e.what();
+        exit(-1);
+    }
+    return 0;
+}
@@ -3,38 +3,72 @@
  * Copyright (C) 2022-2024 Håvard F. Aasen <havard.f.aasen@pfft.no>
  */
 
+#include "bus_poller.h"
+#include "hal.h"
 #include "lichuan_a4.h"
+#include "parameter_dump.h"
+#include "realtime.h"
 
 #include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <atomic>
+#include <chrono>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <functional>
 #include <getopt.h>
 #include <iostream>
 #include <list>
+#include <map>
+#include <memory>
+#include <numeric>
 #include <optional>
+#include <sched.h>
 #include <set>
 #include <sstream>
 #include <string>
+#include <string_view>
 #include <thread>
+#include <vector>
 
 
-static int done = 0;
+static std::atomic<bool> done{false};
+static std::atomic<bool> dump_requested{false};
 
-static const char* option_string = "d:n:r:vt:h";
+static const char* option_string = "b:B:c:d:D:F:g:k:Lmn:P:r:R:sT:vt:h";
 static struct option long_options[] = {
+        {"bus",     required_argument,  nullptr, 'b'},
+        {"byte-timeout", required_argument, nullptr, 'B'},
+        {"cpu",     required_argument,  nullptr, 'c'},
         {"device",  required_argument,  nullptr, 'd'},
+        {"diff",    required_argument,  nullptr, 'D'},
+        {"flight-recorder", required_argument, nullptr, 'F'},
+        {"max-gap", required_argument,  nullptr, 'g'},
+        {"backup",  required_argument,  nullptr, 'k'},
+        {"low-latency", no_argument,    nullptr, 'L'},
+        {"mlock",   no_argument,        nullptr, 'm'},
         {"name",    required_argument,  nullptr, 'n'},
+        {"priority", required_argument, nullptr, 'P'},
         {"rate",    required_argument,  nullptr, 'r'},
+        {"restore", required_argument,  nullptr, 'R'},
+        {"scan",    no_argument,        nullptr, 's'},
         {"verbose", no_argument,        nullptr, 'v'},
         {"target",  required_argument,  nullptr, 't'},
+        {"timeout", required_argument,  nullptr, 'T'},
         {"help",    no_argument,        nullptr, 'h'},
         {nullptr,   0,                  nullptr, 0}
 };
 
 static void quit(int)
 {
-    done = 1;
+    done = true;
+}
+
+static void request_dump(int)
+{
+    dump_requested = true;
 }
 
 void usage(char *argv[])
@@ -45,18 +79,53 @@ void usage(char *argv[])
               << "   Currently this only monitor the Lichuan servo driver.\n"
               << "\n"
               << "Optional arguments:\n"
-              << "   -d, --device <path> (default: '/dev/ttyUSB0')\n"
-              << "       Set the name of the serial device to use\n"
+              << "   -b, --bus <integers> (default: 0)\n"
+              << "       Set which serial device each target is connected to, as an index into the\n"
+              << "       list of devices, starting at 0. Must have the same number of elements as\n"
+              << "       'target'. Each device is polled from its own thread.\n"
+              << "   -B, --byte-timeout <ms> (default: derived from baud rate)\n"
+              << "       Set the time allowed between two bytes in a response.\n"
+              << "   -c, --cpu <integers>\n"
+              << "       Pin the polling thread of each device to a CPU, in the same order as 'device'.\n"
+              << "   -d, --device <paths> (default: '/dev/ttyUSB0')\n"
+              << "       Set the name of the serial devices to use\n"
+              << "   -D, --diff <path>,<path>\n"
+              << "       Show the parameters which differ between two files from 'backup', and exit.\n"
+              << "   -F, --flight-recorder <path>\n"
+              << "       Append the most recent Modbus transactions to <path> on SIGUSR1, on the first\n"
+              << "       error after a period without errors, and on exit.\n"
+              << "   -g, --max-gap <n> (default: " << Lichuan_a4::default_max_gap << ")\n"
+              << "       Read up to <n> unused registers to merge two register groups into one\n"
+              << "       transaction.\n"
+              << "   -k, --backup <path>\n"
+              << "       Save the parameters, PA_000 to PA_0FF, of every target to <path>, and exit.\n"
+              << "   -L, --low-latency\n"
+              << "       Reduce latency of USB serial adapters, the settings are restored on exit.\n"
+              << "   -m, --mlock\n"
+              << "       Lock all memory in RAM, and prefault the stack of the polling threads.\n"
               << "   -n, --name <strings> (default: 'lichuan_a4')\n"
               << "       Set the name of the HAL module. The HAL comp name will be set to <string>, and all pin\n"
               << "       and parameter names will begin with <string>. If multiple names is given, multiple\n"
               << "       HAL modules will be created.\n"
+              << "   -P, --priority <n>\n"
+              << "       Run the polling threads with SCHED_FIFO real-time priority <n>, [1, 99].\n"
               << "   -r, --rate <n> (default: 19200)\n"
               << "       Set baud rate to <n>. It is an error if the rate is not one of the following:\n"
               << "       [2400, 4800, 9600, 19200, 38400, 57600, 115200]\n"
+              << "       'auto' tries each rate, fastest first, and use the rate the drives answer at.\n"
+              << "   -R, --restore <path>\n"
+              << "       Write the parameters in <path> to every target, verify them by reading them\n"
+              << "       back, and exit. Only parameters which differ is written.\n"
+              << "   -s, --scan\n"
+              << "       Probe every target address, 1 to " << Modbus::max_target << ", on each device, report the\n"
+              << "       drives which respond, with round trip time and current error, and exit.\n"
+              << "       The response timeout is derived from the baud rate, unless 'timeout' is set.\n"
               << "   -t, --target <integers> (default: 1)\n"
               << "       Set Modbus target number. This must match the device\n"
               << "       number you set on the Lichuan servo driver.\n"
+              << "   -T, --timeout <ms> (default: adapted to each target)\n"
+              << "       Set a fixed response timeout, instead of adapting it to the measured\n"
+              << "       response time of each target.\n"
               << "   -v, --verbose\n"
               << "       Turn on verbose mode.\n"
               << "   -h, --help\n"
@@ -69,6 +138,16 @@ static std::string trim(const std::string& str) {
     return (first != std::string::npos && last != std::string::npos) ? str.substr(first, last - first + 1) : "";
 }
 
+static std::vector<std::string> split(const std::string& input)
+{
+    std::vector<std::string> values;
+    std::istringstream iss(input);
+    std::string token;
+    while (std::getline(iss, token, ','))
+        values.push_back(trim(token));
+    return values;
+}
+
 template<typename T>
 static std::list<T> parse_arguments(const std::string& input) {
     std::list<T> values;
@@ -85,7 +164,7 @@ static std::list<T> parse_arguments(const std::string& input) {
 
         if constexpr (std::is_same_v<T, int>) {
             int value = std::atoi(token.c_str());
-            if (value < 1 || value > 32) {
+            if (value < 1 || value > Modbus::max_target) {
                 std::cerr << "ERROR: Invalid input in 'target' option: [" << token << "]\n";
                 break;
             }
@@ -95,35 +174,400 @@ static std::list<T> parse_arguments(const std::string& input) {
     return values;
 }
 
+static void dump_flight_recorder(const Modbus& bus, const std::string& path, const char *reason)
+{
+    if (!bus.flight_recorder().dump(path, bus.device(), reason))
+        std::cerr << "ERROR: Unable to write flight recorder to '" << path << "'\n";
+}
+
+/** Period and length of the jitter test, when applying real-time settings. */
+static constexpr std::chrono::nanoseconds jitter_test_period {std::chrono::milliseconds{1}};
+static constexpr int jitter_test_cycles {500};
+
+static void print_round_trip_time(const char *when, const std::optional<std::chrono::microseconds>& rtt)
+{
+    std::cout << "Modbus RTU: round trip time " << when << " low latency: ";
+    if (rtt)
+        std::cout << rtt->count() << " us\n";
+    else
+        std::cout << "no response\n";
+}
+
+/** Apply low latency settings, and report the effect on the round trip time to @p target. */
+static void set_low_latency(Modbus& bus, const int target)
+{
+    print_round_trip_time("before", bus.round_trip_time(target, Lichuan_a4::probe_reg));
+
+    const auto result = bus.set_low_latency();
+    if (!result.async_low_latency)
+        std::cerr << "WARNING: Unable to set ASYNC_LOW_LATENCY on serial device\n";
+    if (!result.latency_timer)
+        std::cerr << "WARNING: Unable to set USB latency timer, not an FTDI adapter?\n";
+
+    print_round_trip_time("after", bus.round_trip_time(target, Lichuan_a4::probe_reg));
+}
+
+/** Probe every target address on @p bus, and write the drives which respond to @p report. */
+static int scan_bus(Modbus& bus, const std::chrono::microseconds timeout, std::ostream& report)
+{
+    using namespace std::chrono;
+    report << bus.device() << ": scanning target 1 to " << Modbus::max_target << ", response timeout "
+           << timeout.count() << " us\n";
+
+    const auto start = steady_clock::now();
+    int responding = 0;
+    for (int target = 1; target <= Modbus::max_target && !done; target++) {
+        const auto result = bus.probe(target, Lichuan_a4::probe_reg, timeout);
+        switch (result.status) {
+            case Rtu_master::Status::done: {
+                report << "  target " << target << ": round trip time " << result.round_trip_time.count()
+                       << " us, ";
+                const std::string_view message = Lichuan_a4::get_error_message(Error_code{result.value});
+                if (message.empty())
+                    report << "no error\n";
+                else
+                    report << "error " << result.value << ", " << message << "\n";
+                break;
+            }
+            case Rtu_master::Status::exception:
+                report << "  target " << target << ": round trip time " << result.round_trip_time.count()
+                       << " us, exception " << static_cast<int>(result.exception_code)
+                       << ", not a Lichuan A4 drive?\n";
+                break;
+            case Rtu_master::Status::crc_error:
+            case Rtu_master::Status::invalid_response:
+                report << "  target " << target << ": " << Rtu_master::status_message(result.status)
+                       << ", more than one drive with this address?\n";
+                break;
+            case Rtu_master::Status::io_error:
+                report << "  ERROR: Scan stopped, unable to use serial device\n";
+                return responding;
+            default:
+                continue;
+        }
+        responding++;
+    }
+    report << bus.device() << ": " << responding << " responding, scan took "
+           << duration_cast<milliseconds>(steady_clock::now() - start).count() << " ms\n";
+    return responding;
+}
+
+/**
+ * @brief Run @p task on all buses at the same time, each from its own thread.
+ *
+ * Called as task(bus, index, report), what is written to report is printed
+ * when every task is done, in the order of the buses.
+ */
+template<typename Task>
+static void run_on_buses(std::list<Modbus>& buses, Task task)
+{
+    std::vector<std::ostringstream> reports(buses.size());
+    std::vector<std::thread> threads;
+    std::size_t index = 0;
+    for (auto& bus : buses) {
+        threads.emplace_back([&task, &bus, index, &report = reports[index]] { task(bus, index, report); });
+        index++;
+    }
+    for (auto& thread : threads)
+        thread.join();
+    for (const auto& report : reports)
+        std::cout << report.str();
+}
+
+/**
+ * @brief Scan all buses at the same time.
+ * @return Number of targets which responded.
+ */
+static int scan_buses(std::list<Modbus>& buses, const std::optional<std::chrono::microseconds>& timeout)
+{
+    std::vector<int> responding(buses.size());
+    run_on_buses(buses, [&responding, timeout](Modbus& bus, const std::size_t index, std::ostream& report) {
+        responding[index] = scan_bus(bus, timeout.value_or(bus.scan_timeout()), report);
+    });
+    return std::accumulate(responding.begin(), responding.end(), 0);
+}
+
+static constexpr int default_baud_rate {19200};
+
+/** Longest time spent looking for drives at each baud rate, when detecting the rate. */
+static constexpr std::chrono::milliseconds baud_detect_time {1'000};
+
+/**
+ * @brief Find the baud rate the drives on @p bus answer at, and use it.
+ *
+ * Tries the rates in @p baud_rates fastest first, until every target has
+ * answered. The bus is left at the rate most targets answered at.
+ * @return @c false if no target answered at any rate.
+ */
+static bool detect_baud_rate(Modbus& bus, const std::set<int>& baud_rates, const std::vector<int>& bus_targets,
+                             std::ostream& report)
+{
+    using namespace std::chrono;
+    std::map<int, int> target_rates;
+    std::map<int, int> answered;
+    for (auto rate = baud_rates.rbegin(); rate != baud_rates.rend() && !done; ++rate) {
+        if (target_rates.size() == bus_targets.size())
+            break;
+        if (!bus.set_baud_rate(*rate)) {
+            report << bus.device() << ": " << *rate << " baud is not supported by the device\n";
+            continue;
+        }
+
+        // The first request after a change of rate may be lost in noise, so try each target twice.
+        const auto deadline = steady_clock::now() + baud_detect_time;
+        for (int attempt = 0; attempt < 2 && steady_clock::now() < deadline; attempt++) {
+            for (const int target : bus_targets) {
+                if (target_rates.count(target) || steady_clock::now() >= deadline)
+                    continue;
+                const auto result = bus.probe(target, Lichuan_a4::probe_reg, bus.scan_timeout());
+                if (result.status == Rtu_master::Status::done || result.status == Rtu_master::Status::exception) {
+                    target_rates[target] = *rate;
+                    answered[*rate]++;
+                }
+            }
+        }
+    }
+
+    if (answered.empty()) {
+        report << bus.device() << ": ERROR: No drive answered at any baud rate\n";
+        return false;
+    }
+
+    // Prefer the faster rate, if the same number of targets answered.
+    int best = answered.rbegin()->first;
+    for (auto rate = answered.rbegin(); rate != answered.rend(); ++rate) {
+        if (rate->second > answered[best])
+            best = rate->first;
+    }
+    bus.set_baud_rate(best);
+    report << bus.device() << ": detected " << best << " baud\n";
+    for (const int target : bus_targets) {
+        const auto found = target_rates.find(target);
+        report << "  target " << target << ": ";
+        if (found == target_rates.end())
+            report << "no response\n";
+        else if (found->second != best)
+            report << found->second << " baud, WARNING: set PA_00D to " << best << " baud\n";
+        else
+            report << found->second << " baud\n";
+    }
+    return true;
+}
+
+/** Targets of each bus, indexed as the buses. */
+static std::vector<std::vector<int>> targets_by_bus(const std::list<int>& targets, const std::list<int>& bus_indexes,
+                                                    const std::size_t bus_count)
+{
+    std::vector<std::vector<int>> bus_targets(bus_count);
+    auto bus_index = bus_indexes.begin();
+    for (const int target : targets)
+        bus_targets[static_cast<std::size_t>(*bus_index++)].push_back(target);
+    return bus_targets;
+}
+
+/**
+ * @brief Save the parameters of every target to @p path.
+ *
+ * RS-485 is half duplex, so the drives on one bus is read one after the
+ * other, while the buses is read at the same time.
+ * @return @c false if any target could not be read, or the file not written.
+ */
+static bool backup_parameters(std::list<Modbus>& buses, const std::vector<std::vector<int>>& bus_targets,
+                              const std::string& path)
+{
+    std::vector<Parameter_dump> dumps(buses.size());
+    std::vector<int> failed(buses.size());
+    run_on_buses(buses, [&](Modbus& bus, const std::size_t index, std::ostream& report) {
+        for (const int target : bus_targets[index]) {
+            const auto start = std::chrono::steady_clock::now();
+            if (!dumps[index].read(bus, target)) {
+                report << bus.device() << ": ERROR: Unable to read the parameters of target " << target << "\n";
+                failed[index]++;
+                continue;
+            }
+            const auto elapsed = std::chrono::steady_clock::now() - start;
+            report << bus.device() << ": target " << target << ": read " << Parameter_dump::param_count
+                   << " parameters in " << std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count()
+                   << " ms\n";
+        }
+    });
+
+    Parameter_dump all;
+    for (const auto& dump : dumps)
+        all.merge(dump);
+    if (all.empty())
+        return false;
+    if (!all.save(path)) {
+        std::cerr << "ERROR: Unable to write parameter file '" << path << "'\n";
+        return false;
+    }
+    std::cout << "Saved parameters to '" << path << "'\n";
+    return std::accumulate(failed.begin(), failed.end(), 0) == 0;
+}
+
+/**
+ * @brief Write the parameters in @p dump to every target, and verify them.
+ * @return @c false if any target is missing from the dump, or not restored.
+ */
+static bool restore_parameters(std::list<Modbus>& buses, const std::vector<std::vector<int>>& bus_targets,
+                               const Parameter_dump& dump)
+{
+    std::vector<int> failed(buses.size());
+    run_on_buses(buses, [&](Modbus& bus, const std::size_t index, std::ostream& report) {
+        for (const int target : bus_targets[index]) {
+            report << bus.device() << ": target " << target << ": ";
+            if (!dump.contains(target)) {
+                report << "ERROR: not in parameter file\n";
+                failed[index]++;
+                continue;
+            }
+            const auto result = dump.restore(bus, target);
+            if (result.read_failed) {
+                report << "ERROR: unable to read parameters\n";
+                failed[index]++;
+                continue;
+            }
+            report << result.changed << " parameters changed, in " << result.transactions << " writes";
+            if (result.failed_writes > 0 || result.mismatches > 0) {
+                report << ", ERROR: " << result.failed_writes << " failed writes, " << result.mismatches
+                       << " parameters don't match";
+                failed[index]++;
+            }
+            report << "\n";
+        }
+    });
+    return std::accumulate(failed.begin(), failed.end(), 0) == 0;
+}
+
+/** Parse timeout in milliseconds, between 1 ms and 10 s. */
+static std::optional<std::chrono::microseconds> parse_timeout(const char *input)
+{
+    char *end = nullptr;
+    const double ms = std::strtod(input, &end);
+    if (end == input || *end != '\0' || ms < 1.0 || ms > 10'000.0)
+        return std::nullopt;
+    return std::chrono::microseconds{static_cast<long>(ms * 1000.0)};
+}
+
 int main(int argc, char *argv[])
 {
-    std::set<int> baud_rates { 2400, 4800, 9600, 19200, 38400, 57600, 115200 };
+    std::set<int> baud_rates(supported_baud_rates.begin(), supported_baud_rates.end());
     std::list<std::string> hal_names { "lichuan_a4" };
     std::list<int> targets { 1 };
-    std::string device = "/dev/ttyUSB0";
-    int baud = 19200;
+    std::vector<std::string> device_names { "/dev/ttyUSB0" };
+    std::list<int> bus_indexes;
+    int baud = default_baud_rate;
+    bool auto_baud = false;
+    int max_gap = Lichuan_a4::default_max_gap;
+    std::optional<std::chrono::microseconds> response_timeout;
+    std::optional<std::chrono::microseconds> byte_timeout;
     bool verbose = false;
+    bool low_latency = false;
+    bool scan = false;
+    std::string flight_recorder_path;
+    std::string backup_path;
+    std::string restore_path;
+    std::vector<std::string> diff_paths;
+    Realtime_options realtime;
+    std::vector<int> cpus;
 
     int opt;
     while ((opt = getopt_long(argc, argv, option_string, long_options, nullptr)) != -1) {
         switch (opt) {
-            case 'd': /* Device name */
-                if (strlen(optarg) > FILENAME_MAX) {
-                    std::cerr << "ERROR: Device name to long\n";
+            case 'B': /* Byte timeout */
+                byte_timeout = parse_timeout(optarg);
+                if (!byte_timeout) {
+                    std::cerr << "ERROR: Invalid byte timeout: [" << optarg << "]\n";
+                    exit(-1);
+                }
+                break;
+            case 'b': /* Bus of each target */
+                bus_indexes.clear();
+                for (const auto& token : split(optarg))
+                    bus_indexes.push_back(std::atoi(token.c_str()));
+                break;
+            case 'c': /* CPU of each bus */
+                cpus.clear();
+                for (const auto& token : split(optarg)) {
+                    const int cpu = std::atoi(token.c_str());
+                    if (token.empty() || cpu < 0 || cpu >= CPU_SETSIZE) {
+                        std::cerr << "ERROR: Invalid input in 'cpu' option: [" << token << "]\n";
+                        exit(-1);
+                    }
+                    cpus.push_back(cpu);
+                }
+                break;
+            case 'd': /* Device names */
+                device_names = split(optarg);
+                for (const auto& name : device_names) {
+                    if (name.empty() || name.size() > FILENAME_MAX) {
+                        std::cerr << "ERROR: Invalid device name: [" << name << "]\n";
+                        exit(-1);
+                    }
+                }
+                break;
+            case 'D': /* Parameter files to compare */
+                diff_paths = split(optarg);
+                if (diff_paths.size() != 2) {
+                    std::cerr << "ERROR: 'diff' needs two files: [" << optarg << "]\n";
                     exit(-1);
                 }
-                device = optarg;
+                break;
+            case 'F': /* Flight recorder */
+                flight_recorder_path = optarg;
+                break;
+            case 'g': /* Register gap */
+                max_gap = std::atoi(optarg);
+                if (max_gap < 0 || max_gap > modbus_max_read_registers) {
+                    std::cerr << "ERROR: Invalid register gap: [" << optarg << "]\n";
+                    exit(-1);
+                }
+                break;
+            case 'k': /* Parameter backup */
+                backup_path = optarg;
+                break;
+            case 'L':
+                low_latency = true;
+                break;
+            case 'm':
+                realtime.lock_memory = true;
                 break;
             case 'n': /* Module base name */
                 hal_names = parse_arguments<std::string>(optarg);
                 break;
+            case 'P': /* Real-time priority */
+                realtime.priority = std::atoi(optarg);
+                if (realtime.priority < 1 || realtime.priority > 99) {
+                    std::cerr << "ERROR: Invalid priority: [" << optarg << "]\n";
+                    exit(-1);
+                }
+                break;
             case 'r': /* Baud rate */
+                if (std::string_view{optarg} == "auto") {
+                    auto_baud = true;
+                    baud = *baud_rates.rbegin();
+                    break;
+                }
+                auto_baud = false;
                 baud = std::atoi(optarg);
                 if (baud_rates.find(baud) == baud_rates.end()) {
                     std::cerr << "ERROR: Invalid baud rate: [" << baud << "]\n";
                     exit(-1);
                 }
                 break;
+            case 'R': /* Parameter restore */
+                restore_path = optarg;
+                break;
+            case 's':
+                scan = true;
+                break;
+            case 'T': /* Response timeout */
+                response_timeout = parse_timeout(optarg);
+                if (!response_timeout) {
+                    std::cerr << "ERROR: Invalid timeout: [" << optarg << "]\n";
+                    exit(-1);
+                }
+                break;
             case 't': /* Target number */
                 targets = parse_arguments<int>(optarg);
                 break;
@@ -139,6 +583,111 @@ int main(int argc, char *argv[])
         }
     }
 
+    if (!diff_paths.empty()) {
+        try {
+            const Parameter_dump first{diff_paths[0]};
+            const Parameter_dump second{diff_paths[1]};
+            exit(Parameter_dump::diff(first, second, std::cout) == 0 ? 0 : 1);
+        } catch (std::runtime_error& error) {
+            std::cerr << error.what();
+            exit(-1);
+        }
+    }
+
+    if (scan) {
+        if (auto_baud) {
+            std::cerr << "ERROR: 'scan' needs a fixed baud rate\n";
+            exit(-1);
+        }
+        signal(SIGINT, quit);
+        signal(SIGTERM, quit);
+        std::list<Modbus> buses;
+        for (const auto& device : device_names) {
+            try {
+                auto& bus = buses.emplace_back(device, baud, Lichuan_a4::data_bits, Lichuan_a4::parity,
+                                               Lichuan_a4::stop_bits, verbose);
+                if (byte_timeout)
+                    bus.set_byte_timeout(*byte_timeout);
+                if (low_latency)
+                    bus.set_low_latency();
+            } catch (std::runtime_error& error) {
+                std::cerr << error.what();
+                exit(-1);
+            }
+        }
+        // Return, instead of exit(), so the serial devices are restored.
+        return scan_buses(buses, response_timeout) > 0 ? 0 : 1;
+    }
+
+    if (bus_indexes.empty())
+        bus_indexes.assign(targets.size(), 0);
+    if (bus_indexes.size() != targets.size()) {
+        std::cerr << "ERROR: 'bus' and 'target' must have the same number of arguments\n";
+        exit(-1);
+    }
+    for (const int index : bus_indexes) {
+        if (index < 0 || static_cast<std::size_t>(index) >= device_names.size()) {
+            std::cerr << "ERROR: Invalid input in 'bus' option: [" << index << "]\n";
+            exit(-1);
+        }
+    }
+
+    if (!backup_path.empty() || !restore_path.empty()) {
+        if (!backup_path.empty() && !restore_path.empty()) {
+            std::cerr << "ERROR: 'backup' and 'restore' can't be used together\n";
+            exit(-1);
+        }
+        if (targets.empty() || std::set<int>(targets.begin(), targets.end()).size() != targets.size()) {
+            std::cerr << "ERROR: 'target' must be unique, and not empty\n";
+            exit(-1);
+        }
+        Parameter_dump dump;
+        if (!restore_path.empty()) {
+            try {
+                dump = Parameter_dump{restore_path};
+            } catch (std::runtime_error& error) {
+                std::cerr << error.what();
+                exit(-1);
+            }
+        }
+        signal(SIGINT, quit);
+        signal(SIGTERM, quit);
+        std::list<Modbus> buses;
+        for (const auto& device : device_names) {
+            try {
+                auto& bus = buses.emplace_back(device, baud, Lichuan_a4::data_bits, Lichuan_a4::parity,
+                                               Lichuan_a4::stop_bits, verbose);
+                if (response_timeout)
+                    bus.set_response_timeout(*response_timeout);
+                if (byte_timeout)
+                    bus.set_byte_timeout(*byte_timeout);
+                if (low_latency)
+                    bus.set_low_latency();
+            } catch (std::runtime_error& error) {
+                std::cerr << error.what();
+                exit(-1);
+            }
+        }
+        const auto bus_targets = targets_by_bus(targets, bus_indexes, buses.size());
+        if (auto_baud) {
+            std::vector<char> detected(buses.size(), true);
+            run_on_buses(buses, [&](Modbus& bus, const std::size_t index, std::ostream& report) {
+                if (bus_targets[index].empty())
+                    return;
+                detected[index] = detect_baud_rate(bus, baud_rates, bus_targets[index], report);
+                if (detected[index] && byte_timeout)
+                    bus.set_byte_timeout(*byte_timeout);
+            });
+            // Reading or writing parameters at a guessed rate would only report every target as failed.
+            if (std::find(detected.begin(), detected.end(), false) != detected.end())
+                return 1;
+        }
+        // Return, instead of exit(), so the serial devices are restored.
+        if (!backup_path.empty())
+            return backup_parameters(buses, bus_targets, backup_path) ? 0 : 1;
+        return restore_parameters(buses, bus_targets, dump) ? 0 : 1;
+    }
+
     if (hal_names.size() != targets.size()) {
         std::cerr << "ERROR: 'name' and 'target' must have the same number of arguments\n";
         exit(-1);
@@ -156,28 +705,113 @@ int main(int argc, char *argv[])
      */
     signal(SIGINT, quit);
     signal(SIGTERM, quit);
+    signal(SIGUSR1, request_dump);
+
+    // Drives on the same serial device share the bus, so it is opened only once.
+    std::list<Modbus> buses;
+    std::list<Bus_poller> pollers;
+    for (const auto& device : device_names) {
+        try {
+            auto& bus = buses.emplace_back(device, baud, Lichuan_a4::data_bits, Lichuan_a4::parity,
+                                           Lichuan_a4::stop_bits, verbose);
+            if (response_timeout)
+                bus.set_response_timeout(*response_timeout);
+            if (byte_timeout)
+                bus.set_byte_timeout(*byte_timeout);
+            pollers.emplace_back(bus);
+        } catch (std::runtime_error& error) {
+            std::cerr << error.what();
+            exit(-1);
+        }
+    }
+
+    if (auto_baud) {
+        const auto bus_targets = targets_by_bus(targets, bus_indexes, buses.size());
+
+        run_on_buses(buses, [&](Modbus& bus, const std::size_t index, std::ostream& report) {
+            if (bus_targets[index].empty())
+                return;
+            if (!detect_baud_rate(bus, baud_rates, bus_targets[index], report)) {
+                report << bus.device() << ": using " << default_baud_rate << " baud\n";
+                bus.set_baud_rate(default_baud_rate);
+            }
+            // A new rate resets the byte timeout.
+            if (byte_timeout)
+                bus.set_byte_timeout(*byte_timeout);
+        });
+    }
 
     std::list<Lichuan_a4> devices;
     for (const auto& name : hal_names) {
         const int target = targets.front();
         targets.pop_front();
+        auto poller = std::next(pollers.begin(), bus_indexes.front());
+        bus_indexes.pop_front();
         try {
-            devices.emplace_back(name, device, target, baud, verbose);
+            poller->add_device(devices.emplace_back(name, std::make_unique<HAL>(name), poller->get_bus(),
+                                                      target, max_gap));
         } catch (std::runtime_error& error) {
             std::cerr << error.what();
             exit(-1);
         }
     }
 
-    double modbus_polling = devices.front().modbus_polling();
-    while (done == 0) {
-        // Don't scan to fast, and not delay more than a few seconds.
-        auto seconds = std::chrono::duration<double>(std::clamp(modbus_polling, 0.001, 2.0));
-        std::this_thread::sleep_for(seconds);
+    if (low_latency) {
+        for (auto& poller : pollers) {
+            if (!poller.empty())
+                set_low_latency(poller.get_bus(), poller.front().get_target());
+        }
+    }
+
+    if (realtime.lock_memory && !lock_process_memory())
+        std::cerr << "ERROR: Unable to lock memory: " << std::strerror(errno) << "\n";
+
+    std::vector<std::thread> threads;
+    std::size_t index = 0;
+    for (auto& poller : pollers) {
+        Realtime_options options = realtime;
+        if (!cpus.empty())
+            options.cpu = cpus[index % cpus.size()];
+        const std::string name = device_names[index++];
+        if (poller.empty())
+            continue;
 
-        for (auto& servo : devices) {
-            servo.read_data();
+        threads.emplace_back([&poller, options, name] {
+            if (options.enabled()) {
+                const auto before = measure_jitter(jitter_test_period, jitter_test_cycles);
+                apply_realtime_options(options);
+                const auto after = measure_jitter(jitter_test_period, jitter_test_cycles);
+                std::cout << name << ": worst cycle jitter " << before.count() / 1000
+                          << " us before, " << after.count() / 1000 << " us after real-time settings\n";
+            }
+            poller.run(done);
+        });
+    }
+    // The polling threads record transactions, dumping them is done from here.
+    while (!done) {
+        std::this_thread::sleep_for(std::chrono::milliseconds{100});
+        const bool requested = dump_requested.exchange(false);
+        if (requested) {
+            // The alarm history is owned by the polling threads, they print it.
+            for (auto& device : devices)
+                device.request_alarm_dump();
         }
+        if (flight_recorder_path.empty())
+            continue;
+        for (auto& bus : buses) {
+            if (bus.flight_recorder().take_trigger())
+                dump_flight_recorder(bus, flight_recorder_path, "error after healthy period");
+            else if (requested)
+                dump_flight_recorder(bus, flight_recorder_path, "requested");
+        }
+    }
+
+    for (auto& thread : threads)
+        thread.join();
+
+    if (!flight_recorder_path.empty()) {
+        for (auto& bus : buses)
+            dump_flight_recorder(bus, flight_recorder_path, "exit");
     }
 
     return 0;
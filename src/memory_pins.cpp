@@ -0,0 +1,13 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ * Copyright (C) 2024 Håvard F. Aasen <havard.f.aasen@pfft.no>
+ */
+
+#include "memory_pins.h"
+
+
+Memory_pins::Memory_pins()
+{
+    pin_data.for_each_pin([this](auto *&pin) { assign(pin); });
+    initialize_data(pin_data);
+}
@@ -0,0 +1,45 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ * Copyright (C) 2024 Håvard F. Aasen <havard.f.aasen@pfft.no>
+ */
+
+/**
+ * @file
+ * @brief Pins and parameters in process memory, without LinuxCNC HAL.
+ */
+
+#ifndef LICHUAN_A4_MEMORY_PINS_H
+#define LICHUAN_A4_MEMORY_PINS_H
+
+#include "pin_sink.h"
+
+#include <deque>
+
+
+/**
+ * @brief Pin sink backed by process memory.
+ *
+ * Used to run, test and benchmark the driver without a running HAL. The
+ * values are read directly through @ref data().
+ */
+class Memory_pins : public Pin_sink {
+public:
+    Memory_pins();
+
+    [[nodiscard]] Pin_data& data() noexcept override { return pin_data; }
+
+private:
+    Pin_data pin_data{};
+    // A deque never moves its elements, the pins point into them.
+    std::deque<double> floats{};
+    std::deque<bool> bits{};
+    std::deque<uint32_t> u32s{};
+    std::deque<int32_t> s32s{};
+
+    void assign(pin_float_t *&pin) { pin = &floats.emplace_back(); }
+    void assign(pin_bit_t *&pin) { pin = &bits.emplace_back(); }
+    void assign(pin_u32_t *&pin) { pin = &u32s.emplace_back(); }
+    void assign(pin_s32_t *&pin) { pin = &s32s.emplace_back(); }
+};
+
+#endif // LICHUAN_A4_MEMORY_PINS_H
@@ -5,76 +5,192 @@
 
 #include "modbus.h"
 
-#include <cerrno>
+#include <algorithm>
 #include <iostream>
-#include <sstream>
 
 Modbus::Modbus(const std::string &device, const int baud_rate, const int data_bits,
-               const char parity, const int stop_bits, const int target, const bool debug)
+               const char parity, const int stop_bits, const bool debug)
+    : rtu{device, baud_rate, data_bits, parity, stop_bits}
 {
     std::cout << "Modbus RTU: device='" << device << "', baud=" << baud_rate
               << ", data bits=" << data_bits << ", parity='" << parity << "', stop bits="
-              << stop_bits << ", target=" << target << "\n";
-
-    mb_ctx = modbus_new_rtu(device.c_str(), baud_rate, parity, data_bits, stop_bits);
-    if (!mb_ctx) {
-        std::ostringstream oss;
-        oss << "ERROR: Can't open modbus serial device: "
-            << modbus_strerror(errno) << "\n";
-        throw std::runtime_error(oss.str());
+              << stop_bits << "\n";
+    if (rtu.get_stable_device() != device)
+        std::cout << "Modbus RTU: Using '" << rtu.get_stable_device() << "' for '" << device << "'\n";
+
+    rtu.set_debug(debug);
+}
+
+bool Modbus::read_registers(const int target, const int address, uint16_t *dest, const int count)
+{
+    if (!rtu.prepare_read_registers(target, address, count))
+        return false;
+
+    if (transaction(target) == Rtu_master::Status::done) {
+        rtu.copy_registers(dest);
+        return true;
     }
 
-    if (modbus_connect(mb_ctx) != 0) {
-        modbus_free(mb_ctx);
-        std::ostringstream oss;
-        oss << "ERROR: Can't connect to serial device: "
-            << modbus_strerror(errno) << "\n";
-        throw std::runtime_error(oss.str());
+    // The lost serial device is reported once, not for every read until it is back.
+    if (!disconnected)
+        std::cerr << "Modbus RTU: ERROR reading data for " << count << " registers, from register "
+                  << address << " on target " << target << ": " << rtu.error_message() << "\n";
+    return false;
+}
+
+bool Modbus::write_register(const int target, const int address, const uint16_t value)
+{
+    if (!rtu.prepare_write_register(target, address, value))
+        return false;
+    return transaction(target) == Rtu_master::Status::done;
+}
+
+bool Modbus::write_registers(const int target, const int address, const uint16_t *values, const int count)
+{
+    if (!rtu.prepare_write_registers(target, address, values, count))
+        return false;
+    return transaction(target) == Rtu_master::Status::done;
+}
+
+std::optional<std::chrono::microseconds> Modbus::round_trip_time(const int target, const int address,
+                                                                const int samples)
+{
+    std::chrono::microseconds total{};
+    int responses = 0;
+    for (int i = 0; i < samples; i++) {
+        uint16_t value{};
+        const auto start = Rtu_master::clock::now();
+        if (!read_registers(target, address, &value, 1))
+            continue;
+        total += std::chrono::duration_cast<std::chrono::microseconds>(Rtu_master::clock::now() - start);
+        responses++;
     }
+    if (responses == 0)
+        return std::nullopt;
+    return total / responses;
+}
+
+Modbus::Probe_result Modbus::probe(const int target, const int address,
+                                   const std::chrono::microseconds timeout) noexcept
+{
+    Probe_result result{};
+    if (!rtu.prepare_read_registers(target, address, 1))
+        return result;
+
+    const auto start = Rtu_master::clock::now();
+    result.status = run(timeout);
+    result.round_trip_time = std::chrono::duration_cast<std::chrono::microseconds>(Rtu_master::clock::now() - start);
+    if (result.status == Rtu_master::Status::done)
+        rtu.copy_registers(&result.value);
+    else if (result.status == Rtu_master::Status::exception)
+        result.exception_code = rtu.exception_code();
+    return result;
+}
+
+bool Modbus::set_baud_rate(const int baud_rate) noexcept
+{
+    if (!rtu.set_baud_rate(baud_rate))
+        return false;
+    timing.fill(Target_timing{});
+    return true;
+}
 
-    modbus_set_debug(mb_ctx, debug);
-    modbus_set_slave(mb_ctx, target);
+std::chrono::microseconds Modbus::scan_timeout() const noexcept
+{
+    const auto timeout = std::chrono::duration_cast<std::chrono::microseconds>(rtu.char_time() * scan_timeout_chars);
+    return std::max(timeout, min_scan_timeout);
 }
 
-Modbus& Modbus::operator=(Modbus&& other) noexcept
+Rtu_master::Status Modbus::transaction(const int target) noexcept
 {
-    if (mb_ctx) {
-        modbus_close(mb_ctx);
-        modbus_free(mb_ctx);
+    const auto status = run(response_timeout(target));
+    if (disconnected || fixed_response_timeout || target < 1 || target > max_target)
+        return status;
+
+    switch (status) {
+        case Rtu_master::Status::done:
+        case Rtu_master::Status::exception:
+        case Rtu_master::Status::crc_error:
+        case Rtu_master::Status::invalid_response:
+            if (rtu.bytes_received() > 0)
+                timing[static_cast<std::size_t>(target)].sample(
+                        std::chrono::duration_cast<std::chrono::microseconds>(rtu.turnaround()));
+            break;
+        case Rtu_master::Status::timeout:
+            timing[static_cast<std::size_t>(target)].backoff();
+            break;
+        default:
+            break;
     }
-    mb_ctx = std::exchange(other.mb_ctx, nullptr);
-    return *this;
+    return status;
 }
 
-Modbus::~Modbus()
+Rtu_master::Status Modbus::run(const std::chrono::microseconds timeout) noexcept
 {
-    if (mb_ctx) {
-        modbus_close(mb_ctx);
-        modbus_free(mb_ctx);
+    if (disconnected && !reconnect()) {
+        last = Rtu_master::Status::io_error;
+        return last;
     }
+
+    rtu.set_response_timeout(timeout);
+    const auto start = Rtu_master::clock::now();
+    const auto status = rtu.transaction();
+    recorder.record(status, Rtu_master::clock::now() - start, rtu.request_frame(), rtu.bytes_sent(),
+                    rtu.response_frame(), rtu.bytes_received());
+    stats.transactions++;
+    stats.timeouts += status == Rtu_master::Status::timeout ? 1 : 0;
+    stats.crc_errors += status == Rtu_master::Status::crc_error ? 1 : 0;
+    last = status;
+    if (status == Rtu_master::Status::io_error && rtu.disconnected()) {
+        std::cerr << "Modbus RTU: ERROR: Lost serial device '" << device() << "': " << rtu.error_message() << "\n";
+        disconnected = true;
+        reconnect_delay = min_reconnect_delay;
+        next_reconnect = Rtu_master::clock::now() + reconnect_delay;
+    }
+    return status;
 }
 
-std::vector<uint16_t> Modbus::read_registers(const int address, const int count) const
+bool Modbus::reconnect() noexcept
 {
-    // Modbus requires an array to read into, but we want to return a vector.
-    std::vector<uint16_t> data{};
-    if (count > MODBUS_MAX_READ_REGISTERS || count < 1) {
-        return data;
+    const auto now = Rtu_master::clock::now();
+    if (now < next_reconnect)
+        return false;
+
+    if (!rtu.reopen()) {
+        reconnect_delay = std::min(reconnect_delay * 2, max_reconnect_delay);
+        next_reconnect = now + reconnect_delay;
+        return false;
     }
+    disconnected = false;
+    reconnect_count++;
+    std::cerr << "Modbus RTU: Reopened serial device '" << device() << "'\n";
+    return true;
+}
 
-    uint16_t data_temp[static_cast<unsigned int>(count)];
-    int retval = modbus_read_registers(mb_ctx, address, count, data_temp);
-    if (retval == count) {
-        data.reserve(static_cast<size_t>(count));
-        data.insert(data.end(), data_temp, data_temp + count);
-        return data;
+std::chrono::microseconds Modbus::response_timeout(const int target) const noexcept
+{
+    if (fixed_response_timeout)
+        return *fixed_response_timeout;
+    if (target < 1 || target > max_target)
+        return initial_response_timeout;
+    return timing[static_cast<std::size_t>(target)].timeout;
+}
+
+void Modbus::Target_timing::sample(const std::chrono::microseconds turnaround) noexcept
+{
+    if (!measured) {
+        smoothed = turnaround;
+        variation = turnaround / 2;
+        measured = true;
+    } else {
+        const auto deviation = turnaround > smoothed ? turnaround - smoothed : smoothed - turnaround;
+        variation += (deviation - variation) / 4;
+        smoothed += (turnaround - smoothed) / 8;
     }
-    std::cerr << "Modbus RTU: ERROR reading data for " << count << " registers, from register "
-              << address << ": " << modbus_strerror(errno) << "\n";
-    return data;
+    timeout = std::clamp(smoothed + 4 * variation, min_response_timeout, max_response_timeout);
 }
 
-bool Modbus::write_register(const int address, const uint16_t value)
+void Modbus::Target_timing::backoff() noexcept
 {
-    return modbus_write_register(mb_ctx, address, value);
+    timeout = std::min(timeout * 2, max_response_timeout);
 }
@@ -5,51 +5,214 @@
 
 /**
  * @file
- * @brief Wrapper for the C Modbus library.
+ * @brief Modbus RTU bus, on top of @ref Rtu_master.
  */
 
 #ifndef LICHUAN_A4_MODBUS_H
 #define LICHUAN_A4_MODBUS_H
 
-#include <modbus.h>
+#include "flight_recorder.h"
+#include "rtu_master.h"
 
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <optional>
 #include <string>
-#include <utility>
-#include <vector>
 
 
+/**
+ * @brief Modbus RTU bus.
+ *
+ * Owns the serial device, which is opened once and shared between every
+ * target connected to the same RS485 line. The target address is switched
+ * for each transaction.
+ *
+ * The response timeout of each target is adapted to its measured
+ * turnaround time, unless a fixed timeout is set.
+ */
 class Modbus {
 public:
     Modbus(const std::string &device, int baud_rate, int data_bits, char parity, int stop_bits,
-           int target, bool debug = false);
-    Modbus(const Modbus&) = delete;
-    Modbus& operator=(const Modbus&) = delete;
-    Modbus(Modbus&& other) noexcept : mb_ctx{std::exchange(other.mb_ctx, nullptr)} {};
-    Modbus& operator=(Modbus&& other) noexcept;
-    ~Modbus();
+           bool debug = false);
 
     /**
      * @brief Write a single value to Modbus register.
      *
      * Modbus function code 0x06 (preset single register).
+     * @param target Address of Modbus device to write to.
      * @param address Modbus register address.
      * @param value Value to write.
      * @return @c true on successful write, otherwise @c false.
      */
-    bool write_register(int address, uint16_t value);
+    bool write_register(int target, int address, uint16_t value);
+
+    /**
+     * @brief Write values to contiguous Modbus registers.
+     *
+     * Modbus function code 0x10 (preset multiple registers).
+     * @param target Address of Modbus device to write to.
+     * @param address First Modbus register address.
+     * @param values Values to write, must hold @p count registers.
+     * @param count Number of registers to write.
+     * @return @c true on successful write, otherwise @c false.
+     */
+    bool write_registers(int target, int address, const uint16_t *values, int count);
 
     /**
      * @brief Read Modbus registers.
      *
      * Modbus function code 0x03 (read holding registers).
+     * @param target Address of Modbus device to read from.
      * @param address Modbus register address.
+     * @param[out] dest Storage for the received data, must hold @p count registers.
      * @param count Number of registers to read.
-     * @return On success, the received data, otherwise empty container.
+     * @return @c true if all registers is read, otherwise @c false.
+     */
+    [[nodiscard]] bool read_registers(int target, int address, uint16_t *dest, int count);
+
+    /**
+     * @brief Read Modbus registers into fixed size storage.
+     *
+     * Reads as many registers as @p dest can hold, no memory is allocated.
+     * @see read_registers(int, int, uint16_t*, int)
+     */
+    template<std::size_t N>
+    [[nodiscard]] bool read_registers(int target, int address, std::array<uint16_t, N>& dest)
+    {
+        static_assert(N > 0 && N <= modbus_max_read_registers, "Invalid number of registers");
+        return read_registers(target, address, dest.data(), static_cast<int>(N));
+    }
+
+    /** @copydoc Rtu_master::set_low_latency() */
+    Rtu_master::Latency_result set_low_latency() noexcept { return rtu.set_low_latency(); }
+
+    /**
+     * @brief Measure round trip time of reading a single register.
+     * @param samples Number of reads to average over.
+     * @return Mean round trip time, or nothing if @p target never responds.
+     */
+    [[nodiscard]] std::optional<std::chrono::microseconds> round_trip_time(int target, int address,
+                                                                           int samples = 10);
+
+    /** Result of @ref probe(). */
+    struct Probe_result {
+        Rtu_master::Status status{Rtu_master::Status::idle};
+        std::chrono::microseconds round_trip_time{};
+        uint16_t value{};           /*!< register read, when status is done */
+        uint8_t exception_code{};   /*!< when status is exception */
+    };
+
+    /**
+     * @brief Read a single register once, to find out if @p target is present.
+     *
+     * Nothing is retried or reported, and the response time is not used to
+     * adapt the response timeout of @p target. A lost serial device is
+     * reopened the same way as for the other requests.
+     * @return Status @ref Rtu_master::Status::idle if the request is invalid.
+     */
+    Probe_result probe(int target, int address, std::chrono::microseconds timeout) noexcept;
+
+    /**
+     * @brief Short response timeout, for probing every address on the bus.
+     *
+     * Derived from the baud rate, since a drive answers within a few
+     * character times, and never shorter than @ref min_scan_timeout.
      */
-    [[nodiscard]] std::vector<uint16_t> read_registers(int address, int count) const;
+    [[nodiscard]] std::chrono::microseconds scan_timeout() const noexcept;
+
+    /**
+     * @brief Change the baud rate of the bus.
+     *
+     * The adapted response timeout of every target is forgotten, and the
+     * byte timeout is derived from the new rate.
+     * @return @c false if the rate is not supported by the serial device.
+     */
+    bool set_baud_rate(int baud_rate) noexcept;
+    [[nodiscard]] int baud_rate() const noexcept { return rtu.get_baud_rate(); }
+
+    /** Use a fixed response timeout for every target, instead of adapting it. */
+    void set_response_timeout(std::chrono::microseconds timeout) noexcept { fixed_response_timeout = timeout; }
+    void set_byte_timeout(std::chrono::microseconds timeout) noexcept { rtu.set_byte_timeout(timeout); }
+
+    /** Current response timeout of @p target. */
+    [[nodiscard]] std::chrono::microseconds response_timeout(int target) const noexcept;
+    [[nodiscard]] std::chrono::microseconds byte_timeout() const noexcept { return rtu.get_byte_timeout(); }
+
+    /** Number of times the serial device has been reopened, after it was gone. */
+    [[nodiscard]] uint32_t reconnects() const noexcept { return reconnect_count; }
+
+    /** Transactions on this bus, since it was opened. */
+    struct Statistics {
+        uint64_t transactions{};    /*!< requests sent, including retries and probes */
+        uint64_t timeouts{};        /*!< requests without a complete response */
+        uint64_t crc_errors{};      /*!< responses with invalid CRC */
+    };
+    [[nodiscard]] const Statistics& statistics() const noexcept { return stats; }
+    /** Status of the most recent transaction, e.g. to tell an exception from a lost response. */
+    [[nodiscard]] Rtu_master::Status last_status() const noexcept { return last; }
+
+    /** Recent transactions on this bus. */
+    [[nodiscard]] Flight_recorder& flight_recorder() noexcept { return recorder; }
+    [[nodiscard]] const Flight_recorder& flight_recorder() const noexcept { return recorder; }
+    [[nodiscard]] const std::string& device() const noexcept { return rtu.get_device(); }
+
+    static constexpr std::chrono::microseconds initial_response_timeout {100'000};
+    /** Leaves room for scheduling and USB latency, a late response costs a flush of the line. */
+    static constexpr std::chrono::microseconds min_response_timeout {20'000};
+    static constexpr std::chrono::microseconds max_response_timeout {500'000};
+
+    /** Time between attempts to reopen a serial device which is gone, doubled for each attempt. */
+    static constexpr std::chrono::milliseconds min_reconnect_delay {100};
+    static constexpr std::chrono::milliseconds max_reconnect_delay {5'000};
+
+    /** Highest Modbus target address. */
+    static constexpr int max_target {247};
+    /** Character times allowed for a target to respond, when scanning the bus. */
+    static constexpr int scan_timeout_chars {20};
+    /** Shortest response timeout when scanning, shorter than for polling to keep a scan fast. */
+    static constexpr std::chrono::microseconds min_scan_timeout {5'000};
 
 private:
-    modbus_t* mb_ctx;
+
+    /**
+     * @brief Response timeout of one target.
+     *
+     * Estimated from the smoothed turnaround time and its mean deviation,
+     * the same way TCP estimates the retransmission timeout (RFC 6298).
+     */
+    struct Target_timing {
+        std::chrono::microseconds smoothed{};   /*!< smoothed turnaround time */
+        std::chrono::microseconds variation{};  /*!< mean deviation of turnaround time */
+        std::chrono::microseconds timeout{initial_response_timeout};
+        bool measured{false};
+
+        void sample(std::chrono::microseconds turnaround) noexcept;
+        void backoff() noexcept;
+    };
+
+    Rtu_master rtu;
+    Flight_recorder recorder{};
+    std::array<Target_timing, max_target + 1> timing{};
+    std::optional<std::chrono::microseconds> fixed_response_timeout{};
+    Statistics stats{};
+    Rtu_master::Status last{Rtu_master::Status::idle};
+
+    bool disconnected{false};   /*!< serial device is gone */
+    std::chrono::milliseconds reconnect_delay{min_reconnect_delay};
+    Rtu_master::clock::time_point next_reconnect{};
+    uint32_t reconnect_count{};
+
+    /**
+     * @brief Run the prepared transaction, with response timeout @p timeout.
+     *
+     * Fails at once while the serial device is gone, until it is reopened.
+     */
+    Rtu_master::Status run(std::chrono::microseconds timeout) noexcept;
+    /** Run the prepared transaction, and update the timing of @p target. */
+    Rtu_master::Status transaction(int target) noexcept;
+    /** Try to reopen the serial device, if the reconnect delay has passed. */
+    bool reconnect() noexcept;
 };
 
 
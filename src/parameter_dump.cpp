@@ -0,0 +1,178 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ * Copyright (C) 2024 Håvard F. Aasen <havard.f.aasen@pfft.no>
+ */
+
+#include "parameter_dump.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+
+
+Parameter_dump::Parameter_dump(const std::string& path)
+{
+    std::ifstream file{path};
+    if (!file) {
+        std::ostringstream oss;
+        oss << "ERROR: Can't open parameter file '" << path << "'\n";
+        throw std::runtime_error(oss.str());
+    }
+
+    std::map<int, std::array<bool, param_count>> seen;
+    std::string line;
+    int line_number = 0;
+    while (std::getline(file, line)) {
+        line_number++;
+        if (line.empty() || line[0] == '#')
+            continue;
+
+        std::istringstream iss{line};
+        int target = 0;
+        std::string param;
+        long value = -1;
+        iss >> target >> param >> value;
+        char *end = nullptr;
+        const long address = param.size() == 6 && param.compare(0, 3, "PA_") == 0
+                ? std::strtol(param.c_str() + 3, &end, 16) : -1;
+        if (!iss || target < 1 || target > Modbus::max_target || !end || *end != '\0'
+            || address < first_param || address > last_param || value < 0 || value > 0xFFFF) {
+            std::ostringstream oss;
+            oss << "ERROR: Invalid line " << line_number << " in parameter file '" << path << "': " << line << "\n";
+            throw std::runtime_error(oss.str());
+        }
+        const auto index = static_cast<std::size_t>(address - first_param);
+        drives[target][index] = static_cast<uint16_t>(value);
+        seen[target][index] = true;
+    }
+
+    // A partial dump would restore zeros to the missing parameters.
+    for (const auto& [target, params] : seen) {
+        if (std::find(params.begin(), params.end(), false) != params.end()) {
+            std::ostringstream oss;
+            oss << "ERROR: Parameter file '" << path << "' is missing parameters of target " << target << "\n";
+            throw std::runtime_error(oss.str());
+        }
+    }
+}
+
+bool Parameter_dump::read_values(Modbus& bus, const int target, Values& values)
+{
+    for (std::size_t i = 0; i < param_count; i += modbus_max_read_registers) {
+        const auto count = std::min(param_count - i, std::size_t{modbus_max_read_registers});
+        if (!bus.read_registers(target, first_param + static_cast<int>(i), &values[i], static_cast<int>(count)))
+            return false;
+    }
+    return true;
+}
+
+bool Parameter_dump::read(Modbus& bus, const int target)
+{
+    Values values{};
+    if (!read_values(bus, target, values))
+        return false;
+    drives[target] = values;
+    return true;
+}
+
+Parameter_dump::Restore_result Parameter_dump::restore(Modbus& bus, const int target) const
+{
+    Restore_result result{};
+    const auto drive = drives.find(target);
+    if (drive == drives.end())
+        return result;
+    const Values& wanted = drive->second;
+
+    Values current{};
+    if (!read_values(bus, target, current)) {
+        result.read_failed = true;
+        return result;
+    }
+
+    // Unchanged parameters is not written, some of them may be read-only.
+    std::size_t i = 0;
+    while (i < param_count) {
+        if (wanted[i] == current[i]) {
+            i++;
+            continue;
+        }
+        std::size_t count = 1;
+        while (i + count < param_count && count < modbus_max_write_registers
+               && wanted[i + count] != current[i + count])
+            count++;
+
+        result.changed += static_cast<int>(count);
+        result.transactions++;
+        if (!bus.write_registers(target, first_param + static_cast<int>(i), &wanted[i], static_cast<int>(count)))
+            result.failed_writes++;
+        i += count;
+    }
+    if (result.changed == 0)
+        return result;
+
+    if (!read_values(bus, target, current)) {
+        result.read_failed = true;
+        return result;
+    }
+    for (std::size_t j = 0; j < param_count; j++)
+        result.mismatches += wanted[j] != current[j] ? 1 : 0;
+    return result;
+}
+
+void Parameter_dump::merge(const Parameter_dump& other)
+{
+    for (const auto& [target, values] : other.drives)
+        drives[target] = values;
+}
+
+bool Parameter_dump::save(const std::string& path) const
+{
+    std::ofstream file{path};
+    if (!file)
+        return false;
+
+    file << "# Lichuan A4 parameters, " << name(first_param) << " to " << name(last_param) << "\n"
+         << "# target parameter value\n";
+    for (const auto& [target, values] : drives) {
+        for (std::size_t i = 0; i < param_count; i++)
+            file << target << " " << name(first_param + static_cast<int>(i)) << " " << values[i] << "\n";
+    }
+    return static_cast<bool>(file);
+}
+
+int Parameter_dump::diff(const Parameter_dump& a, const Parameter_dump& b, std::ostream& out)
+{
+    int differences = 0;
+    for (const auto& [target, values] : a.drives) {
+        const auto other = b.drives.find(target);
+        if (other == b.drives.end()) {
+            out << "target " << target << ": only in first dump\n";
+            differences++;
+            continue;
+        }
+        for (std::size_t i = 0; i < param_count; i++) {
+            if (values[i] == other->second[i])
+                continue;
+            out << "target " << target << " " << name(first_param + static_cast<int>(i)) << ": "
+                << values[i] << " -> " << other->second[i] << "\n";
+            differences++;
+        }
+    }
+    for (const auto& drive : b.drives) {
+        if (!a.contains(drive.first)) {
+            out << "target " << drive.first << ": only in second dump\n";
+            differences++;
+        }
+    }
+    return differences;
+}
+
+std::string Parameter_dump::name(const int address)
+{
+    std::ostringstream oss;
+    oss << "PA_" << std::uppercase << std::hex << std::setw(3) << std::setfill('0') << address;
+    return oss.str();
+}
@@ -0,0 +1,93 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ * Copyright (C) 2024 Håvard F. Aasen <havard.f.aasen@pfft.no>
+ */
+
+/**
+ * @file
+ * @brief Backup, comparison and restore of drive parameters.
+ */
+
+#ifndef LICHUAN_A4_PARAMETER_DUMP_H
+#define LICHUAN_A4_PARAMETER_DUMP_H
+
+#include "modbus.h"
+
+#include <array>
+#include <cstdint>
+#include <map>
+#include <ostream>
+#include <string>
+
+
+/**
+ * @brief The @c PA_xxx parameters of one or more drives.
+ *
+ * Parameter @c PA_xxx is holding register @c 0xxx. The whole parameter space
+ * is read with as few transactions as possible, and written back with one
+ * write multiple registers (0x10) request for each run of changed parameters.
+ *
+ * The file format is text, one parameter on each line:
+ * @code
+ * # target parameter value
+ * 1 PA_000 1
+ * @endcode
+ */
+class Parameter_dump {
+public:
+    static constexpr int first_param {0x000};
+    static constexpr int last_param {0x0FF};
+    static constexpr std::size_t param_count {last_param - first_param + 1};
+    using Values = std::array<uint16_t, param_count>;
+
+    Parameter_dump() = default;
+    /** Load a dump saved by @ref save(), throws @c std::runtime_error if it can't be read. */
+    explicit Parameter_dump(const std::string& path);
+
+    /**
+     * @brief Read every parameter of @p target into the dump.
+     * @return @c false if any read failed, nothing is stored then.
+     */
+    bool read(Modbus& bus, int target);
+
+    struct Restore_result {
+        int changed{};          /*!< parameters which differed from the dump */
+        int transactions{};     /*!< write requests sent */
+        int failed_writes{};    /*!< write requests which failed */
+        int mismatches{};       /*!< parameters which don't match the dump after writing */
+        bool read_failed{false};
+    };
+
+    /**
+     * @brief Write the parameters of @p target from the dump to the drive.
+     *
+     * Only parameters which differ from the drive is written. Every
+     * parameter is read back afterwards, and compared with the dump.
+     */
+    Restore_result restore(Modbus& bus, int target) const;
+
+    /** Add the drives of @p other, replacing drives already in the dump. */
+    void merge(const Parameter_dump& other);
+
+    [[nodiscard]] bool save(const std::string& path) const;
+
+    /**
+     * @brief Write the parameters which differ between @p a and @p b to @p out.
+     * @return Number of differences, a drive missing from one dump counts as one.
+     */
+    static int diff(const Parameter_dump& a, const Parameter_dump& b, std::ostream& out);
+
+    [[nodiscard]] bool contains(int target) const { return drives.find(target) != drives.end(); }
+    [[nodiscard]] bool empty() const noexcept { return drives.empty(); }
+
+    /** Name of parameter @p address, e.g. PA_00D. */
+    [[nodiscard]] static std::string name(int address);
+
+private:
+    std::map<int, Values> drives{};
+
+    /** Read every parameter of @p target into @p values. */
+    static bool read_values(Modbus& bus, int target, Values& values);
+};
+
+#endif // LICHUAN_A4_PARAMETER_DUMP_H
@@ -0,0 +1,27 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ * Copyright (C) 2024 Håvard F. Aasen <havard.f.aasen@pfft.no>
+ */
+
+#include "pin_sink.h"
+
+
+void Pin_sink::initialize_data(Pin_data& data) noexcept
+{
+    data.for_each_pin([](auto *pin) { *pin = 0; });
+
+    data.modbus_polling = 1.0;
+    data.speed_polling = 0.0;
+    data.torque_polling = 0.0;
+    data.digital_IO_polling = 0.0;
+    data.monitor_polling = 1.0;
+    data.monitor_enable = false;
+    data.modbus_errors = 0;
+    data.write_errors = 0;
+    data.health_transitions = 0;
+    data.reconnects = 0;
+    data.response_timeout = 0;
+    data.byte_timeout = 0;
+    data.latency_reset = false;
+    data.alarm_dump = false;
+}
@@ -0,0 +1,132 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ * Copyright (C) 2024 Håvard F. Aasen <havard.f.aasen@pfft.no>
+ */
+
+/**
+ * @file
+ * @brief Pins and parameters of one drive, independent of where they live.
+ */
+
+#ifndef LICHUAN_A4_PIN_SINK_H
+#define LICHUAN_A4_PIN_SINK_H
+
+#include "alarm_history.h"
+#include "register_map.h"
+
+#include <array>
+#include <cstdint>
+#include <initializer_list>
+
+
+/** Storage of pins and parameters, the same types as used by LinuxCNC HAL. */
+using pin_bit_t = volatile bool;
+using pin_float_t = volatile double;
+using pin_u32_t = volatile uint32_t;
+using pin_s32_t = volatile int32_t;
+
+/** Pins and parameters of one drive. */
+struct Pin_data {
+    // Info from driver, in the order of register_map::fields
+    std::array<pin_float_t*, register_map::float_count> numbers{};  /*!< number fields */
+    std::array<pin_bit_t*, register_map::bit_count> bits{};         /*!< bit fields */
+    pin_s32_t       *error_code{};          /*!< servo driver error code */
+    pin_u32_t       *sequence{};            /*!< odd while the values above is updated */
+    pin_bit_t       *online{};              /*!< drive is responding */
+
+    // Polling cycle
+    pin_float_t     *cycle_period{};        /*!< measured polling period [s] */
+    pin_float_t     *cycle_jitter{};        /*!< deviation from requested period [s] */
+    pin_u32_t       *cycle_overruns{};      /*!< cycles which missed their deadline */
+
+    /** Transaction latency of one group of registers [s]. */
+    struct Latency {
+        pin_float_t *p50{};     /*!< median */
+        pin_float_t *p99{};     /*!< 99th percentile */
+        pin_float_t *max{};     /*!< maximum */
+        pin_float_t *mean{};    /*!< mean */
+    };
+    Latency speed_latency{};
+    Latency torque_latency{};
+    Latency digital_IO_latency{};
+    Latency monitor_latency{};
+
+    /** One entry of the alarm history, entry 0 is the newest. */
+    struct Alarm {
+        pin_s32_t   *code{};        /*!< servo driver error code */
+        pin_float_t *first_seen{};  /*!< [s since the epoch] */
+        pin_float_t *cleared{};     /*!< [s since the epoch], 0 while active */
+        pin_float_t *duration{};    /*!< [s] */
+    };
+    std::array<Alarm, Alarm_history::capacity> alarms{};
+    pin_u32_t       *alarm_count{};         /*!< alarms raised since start */
+
+    // Parameters
+    pin_float_t  modbus_polling{};      /*!< Modbus polling frequency [s] */
+    pin_float_t  speed_polling{};       /*!< speed values polling frequency [s] */
+    pin_float_t  torque_polling{};      /*!< torque values polling frequency [s] */
+    pin_float_t  digital_IO_polling{};  /*!< digital IO polling frequency [s] */
+    pin_float_t  monitor_polling{};     /*!< monitoring values polling frequency [s] */
+    pin_bit_t    monitor_enable{};      /*!< read the monitoring values, their registers is not verified */
+    pin_u32_t    modbus_errors{};       /*!< Modbus error count */
+    pin_u32_t    write_errors{};        /*!< failed register writes */
+    pin_u32_t    health_transitions{};  /*!< changes between online, degraded and offline */
+    pin_u32_t    reconnects{};          /*!< serial device reopened */
+    pin_float_t  response_timeout{};    /*!< current response timeout [s] */
+    pin_float_t  byte_timeout{};        /*!< current byte timeout [s] */
+    pin_bit_t    latency_reset{};       /*!< clear latency statistics */
+    pin_bit_t    alarm_dump{};          /*!< print the alarm history */
+
+    /** Call @p f with a reference to every pin pointer. */
+    template<typename F>
+    void for_each_pin(F&& f)
+    {
+        for (auto& pin : numbers)
+            f(pin);
+        for (auto& pin : bits)
+            f(pin);
+        f(cycle_period);
+        f(cycle_jitter);
+        for (auto *latency : {&speed_latency, &torque_latency, &digital_IO_latency, &monitor_latency}) {
+            f(latency->p50);
+            f(latency->p99);
+            f(latency->max);
+            f(latency->mean);
+        }
+        for (auto& alarm : alarms) {
+            f(alarm.code);
+            f(alarm.first_seen);
+            f(alarm.cleared);
+            f(alarm.duration);
+        }
+        f(alarm_count);
+        f(online);
+        f(error_code);
+        f(sequence);
+        f(cycle_overruns);
+    }
+};
+
+
+/**
+ * @brief Destination of the pins and parameters of one drive.
+ *
+ * The driver only sees @ref Pin_data, the backend decides where the values
+ * are stored, e.g. in LinuxCNC HAL shared memory or in process memory.
+ */
+class Pin_sink {
+public:
+    Pin_sink() = default;
+    Pin_sink(const Pin_sink&) = delete;
+    Pin_sink& operator=(const Pin_sink&) = delete;
+    virtual ~Pin_sink() = default;
+
+    /** Pins and parameters, valid for the lifetime of the sink. */
+    [[nodiscard]] virtual Pin_data& data() noexcept = 0;
+
+protected:
+    /** Clear every pin, and set parameters to their default values. */
+    static void initialize_data(Pin_data& data) noexcept;
+};
+
+#endif // LICHUAN_A4_PIN_SINK_H
@@ -0,0 +1,83 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ * Copyright (C) 2024 Håvard F. Aasen <havard.f.aasen@pfft.no>
+ */
+
+#include "realtime.h"
+#include "cycle_timer.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+
+
+namespace {
+
+/** Stack touched by each thread, so page faults happen before the polling starts. */
+constexpr std::size_t prefault_stack_size {256 * 1024};
+
+void prefault_stack() noexcept
+{
+    volatile unsigned char stack[prefault_stack_size];
+    for (std::size_t i = 0; i < prefault_stack_size; i += 4096)
+        stack[i] = 0;
+    static_cast<void>(stack[0]);
+}
+
+} // namespace
+
+
+bool lock_process_memory() noexcept
+{
+    return mlockall(MCL_CURRENT | MCL_FUTURE) == 0;
+}
+
+bool apply_realtime_options(const Realtime_options& options) noexcept
+{
+    bool success = true;
+
+    if (options.cpu) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(static_cast<std::size_t>(*options.cpu), &cpus);
+        const int ret = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+        if (ret != 0) {
+            std::cerr << "ERROR: Unable to pin thread to CPU " << *options.cpu << ": "
+                      << std::strerror(ret) << "\n";
+            success = false;
+        }
+    }
+
+    if (options.priority > 0) {
+        sched_param param{};
+        param.sched_priority = options.priority;
+        const int ret = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+        if (ret != 0) {
+            std::cerr << "ERROR: Unable to set SCHED_FIFO priority " << options.priority << ": "
+                      << std::strerror(ret) << "\n";
+            success = false;
+        }
+    }
+
+    if (options.lock_memory)
+        prefault_stack();
+
+    return success;
+}
+
+std::chrono::nanoseconds measure_jitter(const std::chrono::nanoseconds period, const int cycles) noexcept
+{
+    Cycle_timer timer;
+    std::chrono::nanoseconds worst{};
+    timer.start();
+    for (int i = 0; i < cycles; i++) {
+        timer.wait(period);
+        // The first period starts before the first wait, skip it.
+        if (i > 0)
+            worst = std::max(worst, timer.jitter());
+    }
+    return worst;
+}
@@ -0,0 +1,48 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ * Copyright (C) 2024 Håvard F. Aasen <havard.f.aasen@pfft.no>
+ */
+
+/**
+ * @file
+ * @brief Real-time scheduling, CPU affinity and memory locking of polling threads.
+ */
+
+#ifndef LICHUAN_A4_REALTIME_H
+#define LICHUAN_A4_REALTIME_H
+
+#include <chrono>
+#include <optional>
+
+
+/** Settings applied to each polling thread. */
+struct Realtime_options {
+    int priority{0};            /*!< @c SCHED_FIFO priority, 0 to keep normal scheduling */
+    std::optional<int> cpu{};   /*!< CPU to run on */
+    bool lock_memory{false};    /*!< lock all memory, and prefault the stack */
+
+    [[nodiscard]] bool enabled() const noexcept { return priority > 0 || cpu || lock_memory; }
+};
+
+/**
+ * @brief Lock current and future memory of the process in RAM.
+ * @return @c true on success, otherwise @c false and @c errno is set.
+ */
+[[nodiscard]] bool lock_process_memory() noexcept;
+
+/**
+ * @brief Apply @p options to the calling thread.
+ * @return @c true if all settings is applied, an error is printed for the
+ *         settings which failed.
+ */
+bool apply_realtime_options(const Realtime_options& options) noexcept;
+
+/**
+ * @brief Measure the worst wake-up jitter of the calling thread.
+ *
+ * Runs a periodic timer for a short time, and returns the largest
+ * deviation from the requested period.
+ */
+[[nodiscard]] std::chrono::nanoseconds measure_jitter(std::chrono::nanoseconds period, int cycles) noexcept;
+
+#endif // LICHUAN_A4_REALTIME_H
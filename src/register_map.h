@@ -0,0 +1,264 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ * Copyright (C) 2024 Håvard F. Aasen <havard.f.aasen@pfft.no>
+ */
+
+/**
+ * @file
+ * @brief Registers of the Lichuan A4 drive, and the pins they are published to.
+ */
+
+#ifndef LICHUAN_A4_REGISTER_MAP_H
+#define LICHUAN_A4_REGISTER_MAP_H
+
+#include "register_plan.h"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+
+/**
+ * @brief Table of the polled registers of the drive.
+ *
+ * Each field is one register, or one bit of a register, and the pin it is
+ * published to. Pin creation, the register groups to read and the decoding
+ * of the registers is all derived from @ref fields at compile time, adding a
+ * register only takes a new line in the table.
+ */
+namespace register_map {
+
+/** Register groups, each with its own polling period. */
+enum Group : std::size_t { speed_group, torque_group, digital_IO_group, monitor_group, group_count };
+
+/** Type of the pin a field is published to. */
+enum class Pin_type : uint8_t { float_pin, bit_pin };
+
+struct Field {
+    int address;        /*!< register, the high word of a 32 bit value */
+    int width;          /*!< 16 or 32 bits, 1 for a single bit */
+    int bit;            /*!< bit number, when width is 1 */
+    bool is_signed;     /*!< two's complement value */
+    double scale;       /*!< pin value is register value times scale */
+    Pin_type type;
+    Group group;
+    const char *pin;    /*!< pin name, after the name of the component */
+};
+
+constexpr Field number(const Group group, const int address, const int width, const bool is_signed,
+                       const double scale, const char *pin) noexcept
+{
+    return {address, width, 0, is_signed, scale, Pin_type::float_pin, group, pin};
+}
+
+constexpr Field flag(const Group group, const int address, const int bit, const char *pin) noexcept
+{
+    return {address, 1, bit, false, 1.0, Pin_type::bit_pin, group, pin};
+}
+
+// Fields of the same group must be next to each other.
+inline constexpr std::array<Field, 24> fields {{
+    number(speed_group, 448, 16, true, 1.0, "commanded-speed"),     // [RPM]
+    number(speed_group, 449, 16, true, 1.0, "feedback-speed"),      // [RPM]
+    number(speed_group, 450, 16, true, 1.0, "deviation-speed"),     // [RPM]
+    number(torque_group, 451, 16, false, 0.1, "commanded-torque"),  // [%]
+    number(torque_group, 452, 16, false, 0.1, "feedback-torque"),   // [%]
+    number(torque_group, 453, 16, false, 0.1, "deviation-torque"),  // [%]
+    // Digital IO is configurable from driver, we assume default settings
+    flag(digital_IO_group, 466, 0, "servo-enabling"),
+    flag(digital_IO_group, 466, 1, "clear-alarm"),
+    flag(digital_IO_group, 466, 2, "clockwise-stroke-limit"),
+    flag(digital_IO_group, 466, 3, "anticlockwise-stroke-limit"),
+    flag(digital_IO_group, 466, 4, "clear-deviation-counter"),
+    flag(digital_IO_group, 466, 5, "pulse-prohibition"),
+    flag(digital_IO_group, 466, 6, "torque-limit-switchover"),
+    flag(digital_IO_group, 466, 7, "homing"),
+    flag(digital_IO_group, 467, 0, "servo-ready"),
+    flag(digital_IO_group, 467, 1, "active-alarm"),
+    flag(digital_IO_group, 467, 2, "location-arrival"),
+    flag(digital_IO_group, 467, 3, "brake"),
+    flag(digital_IO_group, 467, 4, "zero-speed"),
+    flag(digital_IO_group, 467, 5, "torque-limiting"),
+    // Monitoring values, right after the current alarm code at 457. The order
+    // and units is those of the monitoring pins of the original driver: DC
+    // bus voltage, torque load ratio, resistance braking rate and torque
+    // overload ratio. They are not verified against the monitoring register
+    // table of the A4 manual, which is not part of this repository, so they
+    // are only read when the monitor-enable parameter is set.
+    number(monitor_group, 458, 16, false, 1.0, "dc-bus-volt"),      // [V]
+    number(monitor_group, 459, 16, false, 1.0, "torque-load"),      // [%]
+    number(monitor_group, 460, 16, false, 1.0, "res-braking"),      // [%]
+    number(monitor_group, 461, 16, false, 1.0, "torque-overload"),  // [%]
+}};
+
+constexpr int last_address(const Field& field) noexcept
+{
+    return field.address + (field.width == 32 ? 1 : 0);
+}
+
+constexpr std::size_t count(const Pin_type type) noexcept
+{
+    std::size_t n = 0;
+    for (const auto& field : fields)
+        n += field.type == type ? 1 : 0;
+    return n;
+}
+
+inline constexpr std::size_t float_count {count(Pin_type::float_pin)};
+inline constexpr std::size_t bit_count {count(Pin_type::bit_pin)};
+
+/** Index of field @p i among the fields with the same pin type. */
+constexpr std::size_t index_of(const std::size_t i) noexcept
+{
+    std::size_t n = 0;
+    for (std::size_t j = 0; j < i; j++)
+        n += fields[j].type == fields[i].type ? 1U : 0U;
+    return n;
+}
+
+/** Index of the bit field published to @p pin, among the bit fields. */
+constexpr std::size_t bit_index(const std::string_view pin) noexcept
+{
+    for (std::size_t i = 0; i < fields.size(); i++) {
+        if (fields[i].type == Pin_type::bit_pin && pin == fields[i].pin)
+            return index_of(i);
+    }
+    return bit_count;
+}
+
+constexpr int first_reg_of_map() noexcept
+{
+    int first = fields[0].address;
+    for (const auto& field : fields)
+        first = field.address < first ? field.address : first;
+    return first;
+}
+
+constexpr int last_reg_of_map() noexcept
+{
+    int last = last_address(fields[0]);
+    for (const auto& field : fields)
+        last = last_address(field) > last ? last_address(field) : last;
+    return last;
+}
+
+/** Range of registers covered by the table. */
+inline constexpr int first_reg {first_reg_of_map()};
+inline constexpr int last_reg {last_reg_of_map()};
+inline constexpr auto register_count {static_cast<std::size_t>(last_reg - first_reg + 1)};
+
+/** Registers read for each group, indexed by @ref Group. */
+constexpr std::array<Register_group, group_count> make_groups() noexcept
+{
+    std::array<Register_group, group_count> groups{};
+    for (std::size_t group = 0; group < group_count; group++) {
+        int first = last_reg;
+        int last = first_reg;
+        for (const auto& field : fields) {
+            if (field.group != group)
+                continue;
+            first = field.address < first ? field.address : first;
+            last = last_address(field) > last ? last_address(field) : last;
+        }
+        groups[group] = {first, last - first + 1};
+    }
+    return groups;
+}
+
+inline constexpr std::array<Register_group, group_count> groups {make_groups()};
+
+/** Fields [begin, end) of one group, among the fields with the same pin type. */
+struct Range {
+    std::size_t begin;
+    std::size_t end;
+};
+
+constexpr std::array<Range, group_count> make_ranges(const Pin_type type) noexcept
+{
+    std::array<Range, group_count> ranges{};
+    std::size_t n = 0;
+    for (std::size_t group = 0; group < group_count; group++) {
+        ranges[group].begin = n;
+        for (const auto& field : fields)
+            n += field.type == type && field.group == group ? 1 : 0;
+        ranges[group].end = n;
+    }
+    return ranges;
+}
+
+inline constexpr std::array<Range, group_count> float_ranges {make_ranges(Pin_type::float_pin)};
+inline constexpr std::array<Range, group_count> bit_ranges {make_ranges(Pin_type::bit_pin)};
+
+/**
+ * @brief How to decode a number field, without branches.
+ *
+ * The raw value is (registers[high] << shift) | (registers[low] & low_mask),
+ * it is sign extended by flipping and subtracting @ref sign_bit.
+ */
+struct Number_decoder {
+    std::size_t high;   /*!< index of the high word */
+    std::size_t low;    /*!< index of the low word */
+    unsigned shift;
+    uint32_t low_mask;
+    int64_t sign_bit;   /*!< 0 for unsigned values */
+    double scale;
+};
+
+struct Bit_decoder {
+    std::size_t word;   /*!< index of the register */
+    unsigned bit;
+};
+
+constexpr std::array<Number_decoder, float_count> make_number_decoders() noexcept
+{
+    std::array<Number_decoder, float_count> decoders{};
+    for (std::size_t i = 0; i < fields.size(); i++) {
+        const auto& field = fields[i];
+        if (field.type != Pin_type::float_pin)
+            continue;
+        const auto word = static_cast<std::size_t>(field.address - first_reg);
+        const bool wide = field.width == 32;
+        decoders[index_of(i)] = {word, wide ? word + 1 : word, wide ? 16U : 0U, wide ? 0xFFFFU : 0U,
+                                 field.is_signed ? (int64_t{1} << (field.width - 1)) : 0, field.scale};
+    }
+    return decoders;
+}
+
+constexpr std::array<Bit_decoder, bit_count> make_bit_decoders() noexcept
+{
+    std::array<Bit_decoder, bit_count> decoders{};
+    for (std::size_t i = 0; i < fields.size(); i++) {
+        const auto& field = fields[i];
+        if (field.type == Pin_type::bit_pin)
+            decoders[index_of(i)] = {static_cast<std::size_t>(field.address - first_reg),
+                                     static_cast<unsigned>(field.bit)};
+    }
+    return decoders;
+}
+
+inline constexpr std::array<Number_decoder, float_count> number_decoders {make_number_decoders()};
+inline constexpr std::array<Bit_decoder, bit_count> bit_decoders {make_bit_decoders()};
+
+constexpr bool is_valid() noexcept
+{
+    for (std::size_t i = 0; i < fields.size(); i++) {
+        const auto& field = fields[i];
+        if (field.type == Pin_type::bit_pin && (field.width != 1 || field.bit < 0 || field.bit > 15))
+            return false;
+        if (field.type == Pin_type::float_pin && field.width != 16 && field.width != 32)
+            return false;
+        if (field.group >= group_count || (i > 0 && field.group < fields[i - 1].group))
+            return false;
+    }
+    for (const auto& group : groups) {
+        if (group.count < 1 || group.count > modbus_max_read_registers)
+            return false;
+    }
+    return true;
+}
+static_assert(is_valid(), "Invalid register map, groups must be sorted and fit in one read");
+
+} // namespace register_map
+
+#endif // LICHUAN_A4_REGISTER_MAP_H
@@ -0,0 +1,41 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ * Copyright (C) 2024 Håvard F. Aasen <havard.f.aasen@pfft.no>
+ */
+
+#include "register_plan.h"
+
+#include <algorithm>
+
+
+void Register_plan::plan(const Register_group *groups, const std::size_t group_count,
+                         const unsigned mask, const int max_gap, const int max_count) noexcept
+{
+    block_count = 0;
+
+    // Sort by start address, the list is short so insertion sort is sufficient.
+    std::array<Register_group, max_blocks> sorted{};
+    std::size_t sorted_count = 0;
+    for (std::size_t i = 0; i < group_count; i++) {
+        if (!(mask & (1U << i)) || groups[i].count < 1)
+            continue;
+        std::size_t pos = sorted_count++;
+        for (; pos > 0 && sorted[pos - 1].start > groups[i].start; pos--)
+            sorted[pos] = sorted[pos - 1];
+        sorted[pos] = groups[i];
+    }
+
+    for (std::size_t i = 0; i < sorted_count; i++) {
+        const Register_group& group = sorted[i];
+        if (block_count > 0) {
+            Register_block& block = blocks[block_count - 1];
+            const int block_end = block.start + block.count;
+            const int new_end = std::max(block_end, group.start + group.count);
+            if (group.start - block_end <= max_gap && new_end - block.start <= max_count) {
+                block.count = new_end - block.start;
+                continue;
+            }
+        }
+        blocks[block_count++] = {group.start, group.count};
+    }
+}
@@ -0,0 +1,84 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ * Copyright (C) 2024 Håvard F. Aasen <havard.f.aasen@pfft.no>
+ */
+
+/**
+ * @file
+ * @brief Merge register groups into as few Modbus transactions as possible.
+ */
+
+#ifndef LICHUAN_A4_REGISTER_PLAN_H
+#define LICHUAN_A4_REGISTER_PLAN_H
+
+#include "rtu_master.h"
+
+#include <array>
+#include <cstddef>
+
+
+/** Contiguous registers which is decoded together. */
+struct Register_group {
+    int start;  /*!< first register address */
+    int count;  /*!< number of registers */
+};
+
+/** Contiguous registers which is read in a single transaction. */
+struct Register_block {
+    int start;  /*!< first register address */
+    int count;  /*!< number of registers */
+
+    [[nodiscard]] constexpr bool contains(const Register_group& group) const noexcept
+    {
+        return group.start >= start && group.start + group.count <= start + count;
+    }
+};
+
+
+/**
+ * @brief Plan of which register blocks to read.
+ *
+ * Adjacent, overlapping and nearly adjacent register groups are merged into
+ * the same block, as long as the block don't exceed the maximum number of
+ * registers a single read can return. The plan has fixed storage, and
+ * planning don't allocate memory.
+ */
+class Register_plan {
+public:
+    static constexpr std::size_t max_blocks {16};
+
+    /**
+     * @brief Plan the reads needed to cover @p groups.
+     *
+     * @param groups Register groups to read, in any order, at most @ref max_blocks.
+     * @param mask Bit mask of which groups to read, bit @c n selects @p groups[n].
+     * @param max_gap Highest number of unused registers read between two
+     *                groups, to merge them into one block. With a negative
+     *                value only overlapping groups is merged.
+     * @param max_count Highest number of registers in one block.
+     */
+    template<std::size_t N>
+    void plan(const std::array<Register_group, N>& groups, unsigned mask, int max_gap,
+              int max_count = modbus_max_read_registers) noexcept
+    {
+        static_assert(N <= max_blocks, "Too many register groups");
+        plan(groups.data(), N, mask, max_gap, max_count);
+    }
+
+    /** Mask selecting every register group. */
+    static constexpr unsigned all_groups {~0U};
+
+    [[nodiscard]] const Register_block* begin() const noexcept { return blocks.data(); }
+    [[nodiscard]] const Register_block* end() const noexcept { return blocks.data() + block_count; }
+    [[nodiscard]] std::size_t size() const noexcept { return block_count; }
+    [[nodiscard]] bool empty() const noexcept { return block_count == 0; }
+
+private:
+    std::array<Register_block, max_blocks> blocks{};
+    std::size_t block_count{};
+
+    void plan(const Register_group *groups, std::size_t group_count, unsigned mask, int max_gap,
+              int max_count) noexcept;
+};
+
+#endif // LICHUAN_A4_REGISTER_PLAN_H
@@ -0,0 +1,660 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ * Copyright (C) 2024 Håvard F. Aasen <havard.f.aasen@pfft.no>
+ */
+
+#include "rtu_master.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <dirent.h>
+#include <fcntl.h>
+#include <fstream>
+#include <iostream>
+#include <linux/serial.h>
+#include <poll.h>
+#include <sstream>
+#include <stdexcept>
+#include <sys/ioctl.h>
+#include <termios.h>
+#include <thread>
+#include <unistd.h>
+#include <utility>
+
+
+namespace {
+
+constexpr std::array<uint16_t, 256> make_crc_table() noexcept
+{
+    std::array<uint16_t, 256> table{};
+    for (std::size_t i = 0; i < table.size(); i++) {
+        auto crc = static_cast<uint16_t>(i);
+        for (int bit = 0; bit < 8; bit++)
+            crc = (crc & 1U) ? static_cast<uint16_t>((crc >> 1U) ^ 0xA001U) : static_cast<uint16_t>(crc >> 1U);
+        table[i] = crc;
+    }
+    return table;
+}
+
+constexpr auto crc_table = make_crc_table();
+
+speed_t to_speed(const int baud_rate) noexcept
+{
+    switch (baud_rate) {
+        case 1200: return B1200;
+        case 2400: return B2400;
+        case 4800: return B4800;
+        case 9600: return B9600;
+        case 19200: return B19200;
+        case 38400: return B38400;
+        case 57600: return B57600;
+        case 115200: return B115200;
+        default: return B0;
+    }
+}
+
+void put_u16(uint8_t *dest, const int value) noexcept
+{
+    dest[0] = static_cast<uint8_t>((value >> 8) & 0xFF);
+    dest[1] = static_cast<uint8_t>(value & 0xFF);
+}
+
+} // namespace
+
+
+uint16_t modbus_crc16(const uint8_t *data, const std::size_t length) noexcept
+{
+    uint16_t crc = 0xFFFF;
+    for (std::size_t i = 0; i < length; i++)
+        crc = static_cast<uint16_t>((crc >> 8U) ^ crc_table[(crc ^ data[i]) & 0xFFU]);
+    return crc;
+}
+
+Rtu_master::Rtu_master(const std::string& _device, const int baud_rate, const int data_bits,
+                       const char parity, const int stop_bits)
+    : device{_device}
+    , stable_device{stable_path(_device)}
+    , settings{baud_rate, data_bits, parity, stop_bits}
+{
+    serial_fd = ::open(stable_device.c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+    if (serial_fd < 0) {
+        std::ostringstream oss;
+        oss << "ERROR: Can't open modbus serial device: " << std::strerror(errno) << "\n";
+        throw std::runtime_error(oss.str());
+    }
+
+    if (!configure(baud_rate, data_bits, parity, stop_bits)) {
+        const int error = errno;
+        close();
+        std::ostringstream oss;
+        oss << "ERROR: Can't configure serial device: " << std::strerror(error) << "\n";
+        throw std::runtime_error(oss.str());
+    }
+
+    set_timing();
+}
+
+void Rtu_master::set_timing() noexcept
+{
+    // One character is a start bit, data bits, optional parity bit and stop bits.
+    const int bits = 1 + settings.data_bits + (settings.parity == 'N' ? 0 : 1) + settings.stop_bits;
+    t_char = std::chrono::nanoseconds{1'000'000'000LL * bits / settings.baud_rate};
+    // The specification recommends fixed values above 19200 baud.
+    if (settings.baud_rate > 19200) {
+        t_1_5 = std::chrono::microseconds{750};
+        t_3_5 = std::chrono::microseconds{1750};
+    } else {
+        t_1_5 = t_char * 3 / 2;
+        t_3_5 = t_char * 7 / 2;
+    }
+    byte_timeout = default_byte_timeout(settings.baud_rate, settings.data_bits, settings.parity, settings.stop_bits);
+}
+
+bool Rtu_master::set_baud_rate(const int baud_rate) noexcept
+{
+    if (baud_rate == settings.baud_rate && serial_fd >= 0)
+        return true;
+    if (serial_fd < 0 || !configure(baud_rate, settings.data_bits, settings.parity, settings.stop_bits))
+        return false;
+
+    settings.baud_rate = baud_rate;
+    set_timing();
+    state = Status::idle;
+    line_idle = clock::now();
+    return true;
+}
+
+std::chrono::microseconds Rtu_master::default_byte_timeout(const int baud_rate, const int data_bits,
+                                                           const char parity, const int stop_bits) noexcept
+{
+    // USB adapters deliver bytes in bursts, so the t1.5 limit from the
+    // specification would cause false timeouts. Allow a few frame gaps, but
+    // not less than one USB latency timer period.
+    const int bits = 1 + data_bits + (parity == 'N' ? 0 : 1) + stop_bits;
+    const std::chrono::microseconds t_3_5{baud_rate > 19200 ? 1750 : 3'500'000LL * bits / baud_rate};
+    return std::max(t_3_5 * 8, std::chrono::microseconds{20'000});
+}
+
+std::chrono::nanoseconds Rtu_master::turnaround() const noexcept
+{
+    if (rx_length == 0 || first_byte < sent)
+        return std::chrono::nanoseconds::zero();
+    return first_byte - sent;
+}
+
+Rtu_master::~Rtu_master()
+{
+    close();
+}
+
+std::string Rtu_master::stable_path(const std::string& device)
+{
+    // The name of a USB serial adapter can change when it is reconnected,
+    // the link in /dev/serial/by-id follows the adapter.
+    constexpr const char *by_id {"/dev/serial/by-id/"};
+    if (device.rfind(by_id, 0) == 0)
+        return device;
+
+    char *resolved = ::realpath(device.c_str(), nullptr);
+    if (!resolved)
+        return device;
+    const std::string target{resolved};
+    std::free(resolved);
+
+    std::string result{device};
+    DIR *dir = ::opendir(by_id);
+    if (!dir)
+        return result;
+    while (const dirent *entry = ::readdir(dir)) {
+        const std::string link = std::string{by_id} + entry->d_name;
+        char *link_target = ::realpath(link.c_str(), nullptr);
+        if (!link_target)
+            continue;
+        const bool match = target == link_target;
+        std::free(link_target);
+        if (match) {
+            result = link;
+            break;
+        }
+    }
+    ::closedir(dir);
+    return result;
+}
+
+bool Rtu_master::reopen() noexcept
+{
+    close();
+
+    serial_fd = ::open(stable_device.c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+    if (serial_fd < 0 || !configure(settings.baud_rate, settings.data_bits, settings.parity, settings.stop_bits)) {
+        io_errno = errno;
+        close();
+        state = Status::io_error;
+        return false;
+    }
+
+    state = Status::idle;
+    recovering = false;
+    line_idle = clock::now();
+    if (low_latency)
+        set_low_latency();
+    return true;
+}
+
+bool Rtu_master::disconnected() const noexcept
+{
+    if (serial_fd < 0)
+        return true;
+    if (state != Status::io_error)
+        return false;
+    return io_errno == EIO || io_errno == ENODEV || io_errno == ENXIO || io_errno == EBADF;
+}
+
+void Rtu_master::close() noexcept
+{
+    if (serial_fd >= 0) {
+        restore_latency();
+        ::close(serial_fd);
+        serial_fd = -1;
+    }
+}
+
+std::string Rtu_master::latency_timer_path() const
+{
+    // The FTDI driver exposes the USB latency timer of the tty in sysfs.
+    char *resolved = ::realpath(stable_device.c_str(), nullptr);
+    if (!resolved)
+        return {};
+    const std::string path{resolved};
+    std::free(resolved);
+    return "/sys/class/tty/" + path.substr(path.find_last_of('/') + 1) + "/device/latency_timer";
+}
+
+Rtu_master::Latency_result Rtu_master::set_low_latency() noexcept
+{
+    Latency_result result{};
+    if (serial_fd < 0)
+        return result;
+    low_latency = true;
+
+    serial_struct serial{};
+    if (ioctl(serial_fd, TIOCGSERIAL, &serial) == 0) {
+        const int flags = serial.flags;
+        serial.flags |= static_cast<int>(ASYNC_LOW_LATENCY);
+        if (ioctl(serial_fd, TIOCSSERIAL, &serial) == 0) {
+            if (!saved_serial_flags)
+                saved_serial_flags = flags;
+            result.async_low_latency = true;
+        }
+    }
+
+    try {
+        const std::string path = latency_timer_path();
+        std::string old_value;
+        if (!path.empty() && std::getline(std::ifstream{path}, old_value)) {
+            std::ofstream timer{path};
+            timer << low_latency_timer_ms << "\n";
+            if (timer.flush()) {
+                if (!saved_latency_timer)
+                    saved_latency_timer = std::make_pair(path, old_value);
+                result.latency_timer = true;
+            }
+        }
+    } catch (const std::exception&) {
+        // Not an FTDI adapter, or no permission to write to sysfs.
+    }
+    return result;
+}
+
+void Rtu_master::restore_latency() noexcept
+{
+    if (saved_serial_flags) {
+        serial_struct serial{};
+        if (ioctl(serial_fd, TIOCGSERIAL, &serial) == 0) {
+            serial.flags = *saved_serial_flags;
+            ioctl(serial_fd, TIOCSSERIAL, &serial);
+        }
+        saved_serial_flags.reset();
+    }
+
+    if (saved_latency_timer) {
+        try {
+            std::ofstream timer{saved_latency_timer->first};
+            timer << saved_latency_timer->second << "\n";
+        } catch (const std::exception&) {
+        }
+        saved_latency_timer.reset();
+    }
+}
+
+bool Rtu_master::configure(const int baud_rate, const int data_bits, const char parity,
+                           const int stop_bits) noexcept
+{
+    const speed_t speed = to_speed(baud_rate);
+    if (speed == B0 || (data_bits != 7 && data_bits != 8) || (stop_bits != 1 && stop_bits != 2)
+        || (parity != 'N' && parity != 'E' && parity != 'O')) {
+        errno = EINVAL;
+        return false;
+    }
+
+    termios tios{};
+    if (tcgetattr(serial_fd, &tios) != 0)
+        return false;
+
+    cfmakeraw(&tios);
+    cfsetispeed(&tios, speed);
+    cfsetospeed(&tios, speed);
+    tios.c_cflag |= CLOCAL | CREAD;
+    tios.c_cflag &= ~static_cast<tcflag_t>(CSIZE | PARENB | PARODD | CSTOPB | CRTSCTS);
+    tios.c_cflag |= (data_bits == 7) ? CS7 : CS8;
+    if (stop_bits == 2)
+        tios.c_cflag |= CSTOPB;
+    if (parity != 'N') {
+        tios.c_cflag |= PARENB;
+        if (parity == 'O')
+            tios.c_cflag |= PARODD;
+        tios.c_iflag |= INPCK;
+    }
+    tios.c_cc[VMIN] = 0;
+    tios.c_cc[VTIME] = 0;
+
+    if (tcsetattr(serial_fd, TCSANOW, &tios) != 0)
+        return false;
+    tcflush(serial_fd, TCIOFLUSH);
+    return true;
+}
+
+void Rtu_master::finish_frame() noexcept
+{
+    const uint16_t crc = modbus_crc16(current.data.data(), current.length);
+    current.data[current.length++] = static_cast<uint8_t>(crc & 0xFF);
+    current.data[current.length++] = static_cast<uint8_t>(crc >> 8);
+    prepared = true;
+}
+
+bool Rtu_master::prepare_read_registers(const int target, const int address, const int count) noexcept
+{
+    if (target < 1 || target > 247 || address < 0 || address > 0xFFFF
+        || count < 1 || count > modbus_max_read_registers)
+        return false;
+
+    current.target = target;
+    current.function = read_holding_registers;
+    current.count = count;
+    current.data[0] = static_cast<uint8_t>(target);
+    current.data[1] = read_holding_registers;
+    put_u16(&current.data[2], address);
+    put_u16(&current.data[4], count);
+    current.length = 6;
+    current.response_length = 5 + 2 * static_cast<std::size_t>(count);
+    finish_frame();
+    return true;
+}
+
+bool Rtu_master::prepare_write_register(const int target, const int address, const uint16_t value) noexcept
+{
+    if (target < 0 || target > 247 || address < 0 || address > 0xFFFF)
+        return false;
+
+    current.target = target;
+    current.function = write_single_register;
+    current.count = 1;
+    current.data[0] = static_cast<uint8_t>(target);
+    current.data[1] = write_single_register;
+    put_u16(&current.data[2], address);
+    put_u16(&current.data[4], value);
+    current.length = 6;
+    current.response_length = 8;
+    finish_frame();
+    return true;
+}
+
+bool Rtu_master::prepare_write_registers(const int target, const int address, const uint16_t *values,
+                                         const int count) noexcept
+{
+    if (target < 0 || target > 247 || address < 0 || address > 0xFFFF
+        || count < 1 || count > modbus_max_write_registers)
+        return false;
+
+    current.target = target;
+    current.function = write_multiple_registers;
+    current.count = count;
+    current.data[0] = static_cast<uint8_t>(target);
+    current.data[1] = write_multiple_registers;
+    put_u16(&current.data[2], address);
+    put_u16(&current.data[4], count);
+    current.data[6] = static_cast<uint8_t>(2 * count);
+    current.length = 7;
+    for (int i = 0; i < count; i++) {
+        put_u16(&current.data[current.length], values[i]);
+        current.length += 2;
+    }
+    current.response_length = 8;
+    finish_frame();
+    return true;
+}
+
+Rtu_master::Status Rtu_master::start() noexcept
+{
+    if (serial_fd < 0) {
+        io_errno = EBADF;
+        state = Status::io_error;
+        return state;
+    }
+    if (!prepared) {
+        state = Status::idle;
+        return state;
+    }
+
+    if (recovering)
+        drain();
+
+    // Respect the silent interval between frames.
+    const auto gap_end = line_idle + t_3_5;
+    if (clock::now() < gap_end)
+        std::this_thread::sleep_until(gap_end);
+
+    prepared = false;
+    rx_length = 0;
+    rx_expected = current.response_length;
+    exception = 0;
+
+    // Drop anything left from an earlier, timed out, transaction.
+    tcflush(serial_fd, TCIFLUSH);
+
+    if (!write_frame()) {
+        io_errno = errno;
+        state = Status::io_error;
+        return state;
+    }
+    if (debug)
+        print_frame(current.data.data(), current.length, true);
+
+    // write() returns when the kernel has the frame, not when it is on the wire.
+    sent = clock::now() + t_char * static_cast<long>(current.length);
+    line_idle = sent;
+
+    if (current.target == 0) {
+        // Broadcast, no response.
+        state = Status::done;
+        return state;
+    }
+    // Allow for the whole response to be transmitted, not only the first byte.
+    deadline = sent + response_timeout + t_char * static_cast<long>(rx_expected);
+    state = Status::pending;
+    return state;
+}
+
+bool Rtu_master::write_frame() noexcept
+{
+    std::size_t written = 0;
+    while (written < current.length) {
+        const ssize_t n = ::write(serial_fd, current.data.data() + written, current.length - written);
+        if (n > 0) {
+            written += static_cast<std::size_t>(n);
+            continue;
+        }
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && errno != EAGAIN)
+            return false;
+
+        pollfd pfd{serial_fd, POLLOUT, 0};
+        if (::poll(&pfd, 1, 100) < 0 && errno != EINTR)
+            return false;
+    }
+    return true;
+}
+
+Rtu_master::Status Rtu_master::poll() noexcept
+{
+    if (state != Status::pending)
+        return state;
+
+    while (rx_length < rx_expected) {
+        const ssize_t n = ::read(serial_fd, rx.data() + rx_length, rx_expected - rx_length);
+        if (n > 0) {
+            const auto now = clock::now();
+            if (rx_length == 0)
+                first_byte = now;
+            rx_length += static_cast<std::size_t>(n);
+            line_idle = now;
+            // An exception response is shorter than the normal response.
+            if (rx_length >= 2 && (rx[1] & 0x80U))
+                rx_expected = exception_frame_size;
+            deadline = now + byte_timeout + t_char * static_cast<long>(rx_expected - rx_length);
+            continue;
+        }
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && errno != EAGAIN) {
+            io_errno = errno;
+            state = Status::io_error;
+            return state;
+        }
+        break;
+    }
+
+    if (rx_length >= rx_expected) {
+        if (debug)
+            print_frame(rx.data(), rx_length, false);
+        state = validate();
+        recovering = state == Status::crc_error || state == Status::invalid_response;
+        if (recovering)
+            line_idle = clock::now();
+        return state;
+    }
+
+    if (clock::now() >= deadline) {
+        if (debug && rx_length > 0)
+            print_frame(rx.data(), rx_length, false);
+        state = Status::timeout;
+        // The response may still be on its way, the line is only known to be quiet from now.
+        recovering = true;
+        line_idle = clock::now();
+    }
+    return state;
+}
+
+void Rtu_master::drain() noexcept
+{
+    recovering = false;
+    const auto idle = std::max<clock::duration>(t_3_5, recovery_idle);
+    const auto give_up = clock::now() + max_recovery;
+    auto quiet = line_idle + idle;
+    std::size_t discarded = 0;
+    for (auto now = clock::now(); now < quiet && now < give_up; now = clock::now()) {
+        const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::min(quiet, give_up) - now).count();
+        const timespec timeout{static_cast<time_t>(ns / 1'000'000'000), static_cast<long>(ns % 1'000'000'000)};
+        pollfd pfd{serial_fd, POLLIN, 0};
+        if (::ppoll(&pfd, 1, &timeout, nullptr) < 0 && errno != EINTR)
+            break;
+        if (pfd.revents & (POLLERR | POLLHUP | POLLNVAL))
+            break;
+        if (!(pfd.revents & POLLIN))
+            continue;
+
+        std::array<uint8_t, max_frame_size> scratch{};
+        const ssize_t n = ::read(serial_fd, scratch.data(), scratch.size());
+        if (n > 0) {
+            discarded += static_cast<std::size_t>(n);
+            line_idle = clock::now();
+            quiet = line_idle + idle;
+        }
+    }
+    tcflush(serial_fd, TCIFLUSH);
+    if (debug && discarded > 0)
+        std::printf("Discarded %zu late bytes\n", discarded);
+}
+
+Rtu_master::Status Rtu_master::wait() noexcept
+{
+    while (poll() == Status::pending) {
+        const auto remaining = deadline - clock::now();
+        if (remaining <= clock::duration::zero())
+            continue;
+        const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(remaining).count();
+        const timespec timeout{static_cast<time_t>(ns / 1'000'000'000), static_cast<long>(ns % 1'000'000'000)};
+        pollfd pfd{serial_fd, POLLIN, 0};
+        if (::ppoll(&pfd, 1, &timeout, nullptr) < 0 && errno != EINTR) {
+            io_errno = errno;
+            state = Status::io_error;
+            break;
+        }
+        if (pfd.revents & (POLLERR | POLLHUP | POLLNVAL)) {
+            // Let read() report the error, if there is one.
+            if (poll() == Status::pending) {
+                io_errno = EIO;
+                state = Status::io_error;
+            }
+            break;
+        }
+    }
+    return state;
+}
+
+Rtu_master::Status Rtu_master::transaction() noexcept
+{
+    if (start() != Status::pending)
+        return state;
+    return wait();
+}
+
+Rtu_master::Status Rtu_master::validate() noexcept
+{
+    const uint16_t crc = modbus_crc16(rx.data(), rx_length - 2);
+    if (rx[rx_length - 2] != (crc & 0xFF) || rx[rx_length - 1] != (crc >> 8))
+        return Status::crc_error;
+
+    if (rx[0] != current.data[0])
+        return Status::invalid_response;
+
+    if (rx[1] == (current.function | 0x80U)) {
+        exception = rx[2];
+        return Status::exception;
+    }
+    if (rx[1] != current.function)
+        return Status::invalid_response;
+
+    switch (current.function) {
+        case read_holding_registers:
+            if (rx[2] != 2 * current.count)
+                return Status::invalid_response;
+            break;
+        case write_single_register:
+            // Response is an echo of the request.
+            if (std::memcmp(rx.data(), current.data.data(), 6) != 0)
+                return Status::invalid_response;
+            break;
+        case write_multiple_registers:
+            // Response echoes address and count.
+            if (std::memcmp(rx.data() + 2, current.data.data() + 2, 4) != 0)
+                return Status::invalid_response;
+            break;
+        default:
+            return Status::invalid_response;
+    }
+    return Status::done;
+}
+
+void Rtu_master::copy_registers(uint16_t *dest) const noexcept
+{
+    for (int i = 0; i < current.count; i++) {
+        const auto offset = 3 + 2 * static_cast<std::size_t>(i);
+        dest[i] = static_cast<uint16_t>((rx[offset] << 8U) | rx[offset + 1]);
+    }
+}
+
+const char* Rtu_master::error_message() const noexcept
+{
+    if (state == Status::io_error)
+        return std::strerror(io_errno);
+    return status_message(state);
+}
+
+const char* Rtu_master::status_message(const Status status) noexcept
+{
+    switch (status) {
+        case Status::idle: return "no request";
+        case Status::pending: return "waiting for response";
+        case Status::done: return "success";
+        case Status::timeout: return "connection timed out";
+        case Status::crc_error: return "invalid CRC";
+        case Status::exception: return "exception response";
+        case Status::invalid_response: return "invalid response";
+        case Status::io_error: return "I/O error";
+    }
+    return "unknown status";
+}
+
+void Rtu_master::print_frame(const uint8_t *data, const std::size_t length, const bool sent) const
+{
+    const char open = sent ? '[' : '<';
+    const char close = sent ? ']' : '>';
+    for (std::size_t i = 0; i < length; i++)
+        std::printf("%c%.2X%c", open, data[i], close);
+    std::printf("\n");
+}
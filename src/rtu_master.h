@@ -0,0 +1,293 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ * Copyright (C) 2024 Håvard F. Aasen <havard.f.aasen@pfft.no>
+ */
+
+/**
+ * @file
+ * @brief Modbus RTU master on a non-blocking serial device.
+ *
+ * Only the function codes needed by the driver is implemented, 0x03 (read
+ * holding registers), 0x06 (write single register) and 0x10 (write multiple
+ * registers). Since the length of every response is known up front, a
+ * transaction is complete as soon as the expected number of bytes has
+ * arrived, without waiting for an inter-frame timeout.
+ */
+
+#ifndef LICHUAN_A4_RTU_MASTER_H
+#define LICHUAN_A4_RTU_MASTER_H
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <utility>
+
+
+/** Highest number of registers in a single read request. */
+constexpr int modbus_max_read_registers {125};
+/** Highest number of registers in a single write request. */
+constexpr int modbus_max_write_registers {123};
+
+/** Baud rates supported by the Lichuan A4 drive. */
+constexpr std::array<int, 7> supported_baud_rates { 2400, 4800, 9600, 19200, 38400, 57600, 115200 };
+
+/**
+ * @brief Calculate Modbus RTU CRC-16.
+ * @return CRC, the low byte is transmitted first.
+ */
+[[nodiscard]] uint16_t modbus_crc16(const uint8_t *data, std::size_t length) noexcept;
+
+
+class Rtu_master {
+public:
+    using clock = std::chrono::steady_clock;
+
+    enum class Status {
+        idle,               /*!< no transaction started */
+        pending,            /*!< waiting for response */
+        done,               /*!< valid response received */
+        timeout,            /*!< no, or incomplete, response */
+        crc_error,          /*!< response with invalid CRC */
+        exception,          /*!< target responded with an exception */
+        invalid_response,   /*!< response don't match request */
+        io_error,           /*!< error from serial device, see @c errno */
+    };
+
+    /** Function codes supported by the master. */
+    enum Function : uint8_t {
+        read_holding_registers = 0x03,
+        write_single_register = 0x06,
+        write_multiple_registers = 0x10,
+    };
+
+    Rtu_master(const std::string& device, int baud_rate, int data_bits, char parity, int stop_bits);
+    Rtu_master(const Rtu_master&) = delete;
+    Rtu_master& operator=(const Rtu_master&) = delete;
+    Rtu_master(Rtu_master&&) = delete;
+    Rtu_master& operator=(Rtu_master&&) = delete;
+    ~Rtu_master();
+
+    /** Print every frame in hex. */
+    void set_debug(bool enable) noexcept { debug = enable; }
+
+    /**
+     * @brief Time allowed from request is sent, to the first byte of the response.
+     *
+     * The time to transmit the expected response is added to this, based on
+     * baud rate and frame length.
+     */
+    void set_response_timeout(std::chrono::microseconds timeout) noexcept { response_timeout = timeout; }
+    [[nodiscard]] std::chrono::microseconds get_response_timeout() const noexcept { return response_timeout; }
+
+    /**
+     * @brief Time allowed between two bytes in a response.
+     *
+     * The time to transmit the rest of the expected response is added to this.
+     */
+    void set_byte_timeout(std::chrono::microseconds timeout) noexcept { byte_timeout = timeout; }
+    [[nodiscard]] std::chrono::microseconds get_byte_timeout() const noexcept { return byte_timeout; }
+
+    /** Byte timeout used when not set explicitly, derived from the baud rate. */
+    [[nodiscard]] static std::chrono::microseconds default_byte_timeout(int baud_rate, int data_bits,
+                                                                        char parity, int stop_bits) noexcept;
+
+    /** Which low latency settings was applied by @ref set_low_latency(). */
+    struct Latency_result {
+        bool async_low_latency{false};  /*!< @c ASYNC_LOW_LATENCY flag of the tty */
+        bool latency_timer{false};      /*!< USB latency timer of FTDI adapters */
+    };
+
+    /**
+     * @brief Reduce latency of USB serial adapters.
+     *
+     * Sets the @c ASYNC_LOW_LATENCY flag, and lowers the latency timer of FTDI
+     * adapters through sysfs. The old settings are restored when the device
+     * is closed.
+     */
+    Latency_result set_low_latency() noexcept;
+
+    /** USB latency timer set by @ref set_low_latency() [ms]. */
+    static constexpr int low_latency_timer_ms {1};
+
+    /**
+     * @brief Close and open the serial device again.
+     *
+     * Used when the device is gone, e.g. when a USB serial adapter is reset.
+     * The device is opened through its link in @c /dev/serial/by-id, when
+     * there is one, since the name of the tty may change. Low latency
+     * settings is applied again.
+     * @return @c false if the device can't be opened.
+     */
+    bool reopen() noexcept;
+
+    /** If the last error means the serial device is gone, and must be reopened. */
+    [[nodiscard]] bool disconnected() const noexcept;
+
+    /** Path used to open the device, the stable @c /dev/serial/by-id link when there is one. */
+    [[nodiscard]] const std::string& get_stable_device() const noexcept { return stable_device; }
+
+    /**
+     * @brief Change the baud rate of the open serial device.
+     *
+     * The frame timing, and the byte timeout, is derived from the new rate.
+     * @return @c false if the rate is not supported by the device.
+     */
+    bool set_baud_rate(int baud_rate) noexcept;
+    [[nodiscard]] int get_baud_rate() const noexcept { return settings.baud_rate; }
+
+    /** Time to transmit one character, including start, parity and stop bits. */
+    [[nodiscard]] std::chrono::nanoseconds char_time() const noexcept { return t_char; }
+    /** Silent interval which separate two frames. */
+    [[nodiscard]] std::chrono::nanoseconds frame_gap() const noexcept { return t_3_5; }
+
+    /**
+     * @brief Prepare a read holding registers (0x03) request.
+     *
+     * The request is sent by the next @ref transaction().
+     * @return @c false if the arguments are invalid.
+     */
+    bool prepare_read_registers(int target, int address, int count) noexcept;
+    /** @brief Prepare a write single register (0x06) request. @see prepare_read_registers() */
+    bool prepare_write_register(int target, int address, uint16_t value) noexcept;
+    /** @brief Prepare a write multiple registers (0x10) request. @see prepare_read_registers() */
+    bool prepare_write_registers(int target, int address, const uint16_t *values, int count) noexcept;
+
+    /**
+     * @brief Send the prepared request and wait for the response.
+     *
+     * If the previous frame was less than t3.5 ago, this sleeps for the rest
+     * of the silent interval first.
+     * @return @ref Status::idle if no request is prepared.
+     */
+    Status transaction() noexcept;
+
+    [[nodiscard]] Status status() const noexcept { return state; }
+
+    /**
+     * @brief Copy registers from a successful read response.
+     * @param[out] dest Must hold as many registers as was requested.
+     */
+    void copy_registers(uint16_t *dest) const noexcept;
+
+    /**
+     * @brief Time from the request was transmitted, to the first byte of the response.
+     *
+     * This is the processing time of the target, including any latency in
+     * the serial adapter. Zero if nothing is received.
+     */
+    [[nodiscard]] std::chrono::nanoseconds turnaround() const noexcept;
+
+    /** Exception code, when status is @ref Status::exception. */
+    [[nodiscard]] uint8_t exception_code() const noexcept { return exception; }
+
+    /** Bytes sent and received by the last transaction. */
+    [[nodiscard]] std::size_t bytes_sent() const noexcept { return current.length; }
+    [[nodiscard]] std::size_t bytes_received() const noexcept { return rx_length; }
+
+    /** Raw request and response frames of the last transaction. */
+    [[nodiscard]] const uint8_t* request_frame() const noexcept { return current.data.data(); }
+    [[nodiscard]] const uint8_t* response_frame() const noexcept { return rx.data(); }
+
+    /** Description of the current status. */
+    [[nodiscard]] const char* error_message() const noexcept;
+    [[nodiscard]] static const char* status_message(Status status) noexcept;
+
+    [[nodiscard]] const std::string& get_device() const noexcept { return device; }
+
+private:
+    /** Largest RTU frame, address, PDU and CRC. */
+    static constexpr std::size_t max_frame_size {256};
+    static constexpr std::size_t exception_frame_size {5};
+    /** Quiet time on the line after a failed transaction, before the next request is sent. */
+    static constexpr std::chrono::milliseconds recovery_idle {20};
+    /** Longest time spent waiting for the line to be quiet. */
+    static constexpr std::chrono::milliseconds max_recovery {100};
+
+    struct Frame {
+        std::array<uint8_t, max_frame_size> data{};
+        std::size_t length{};
+        std::size_t response_length{};  /*!< expected length of a normal response */
+        uint8_t function{};
+        int target{};
+        int count{};                    /*!< registers requested */
+    };
+
+    int serial_fd{-1};
+    bool debug{false};
+    std::string device;
+    std::string stable_device;
+
+    struct Settings {
+        int baud_rate;
+        int data_bits;
+        char parity;
+        int stop_bits;
+    };
+    Settings settings;
+    bool low_latency{false};    /*!< apply low latency settings when reopened */
+
+    std::chrono::nanoseconds t_char{};
+    std::chrono::nanoseconds t_1_5{};
+    std::chrono::nanoseconds t_3_5{};
+    std::chrono::microseconds response_timeout{500'000};
+    std::chrono::microseconds byte_timeout{};
+
+    Frame current{};    /*!< request prepared, or on the wire */
+    bool prepared{false};
+
+    std::array<uint8_t, max_frame_size> rx{};
+    std::size_t rx_length{};
+    std::size_t rx_expected{};
+    uint8_t exception{};
+    int io_errno{};     /*!< @c errno of last @ref Status::io_error */
+    Status state{Status::idle};
+    /** A late or partial response may still arrive, see @ref drain(). */
+    bool recovering{false};
+
+    clock::time_point line_idle{};  /*!< when the bus is silent, last byte sent or received */
+    clock::time_point sent{};       /*!< when the request was transmitted */
+    clock::time_point first_byte{}; /*!< when the first byte of the response was received */
+    clock::time_point deadline{};   /*!< when the pending transaction times out */
+
+    std::optional<int> saved_serial_flags{};
+    /** sysfs path and old value of the USB latency timer. */
+    std::optional<std::pair<std::string, std::string>> saved_latency_timer{};
+
+    void close() noexcept;
+    /**
+     * @brief Discard input until the line has been quiet for @ref recovery_idle.
+     *
+     * A flush before the request can't catch a response which arrives after
+     * it, and would be taken as the response of the next request.
+     */
+    void drain() noexcept;
+    /** Link in @c /dev/serial/by-id to the same device as @p device, or @p device. */
+    [[nodiscard]] static std::string stable_path(const std::string& device);
+    [[nodiscard]] std::string latency_timer_path() const;
+    void restore_latency() noexcept;
+    bool configure(int baud_rate, int data_bits, char parity, int stop_bits) noexcept;
+    /** Derive character time, frame gaps and byte timeout from @ref settings. */
+    void set_timing() noexcept;
+    void finish_frame() noexcept;
+    /**
+     * @brief Send the prepared request.
+     * @return @ref Status::pending on success.
+     */
+    Status start() noexcept;
+    /**
+     * @brief Read whatever is available, without blocking.
+     * @return @ref Status::pending until the transaction is complete or failed.
+     */
+    Status poll() noexcept;
+    /** Block until the current transaction is complete or failed. */
+    Status wait() noexcept;
+    bool write_frame() noexcept;
+    Status validate() noexcept;
+    void print_frame(const uint8_t *data, std::size_t length, bool sent) const;
+};
+
+
+#endif // LICHUAN_A4_RTU_MASTER_H
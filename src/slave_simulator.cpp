@@ -0,0 +1,323 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ * Copyright (C) 2024 Håvard F. Aasen <havard.f.aasen@pfft.no>
+ */
+
+#include "slave_simulator.h"
+
+#include "rtu_master.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <sstream>
+#include <stdexcept>
+#include <termios.h>
+#include <thread>
+#include <unistd.h>
+
+
+namespace {
+
+/**
+ * Register values of an idle, enabled drive. The meaning of each register
+ * is the same as in register_map::fields, every value is different from
+ * zero so a register read into the wrong pin is seen.
+ */
+constexpr std::array<std::pair<int, uint16_t>, 12> default_registers {{
+    {448, 1000},    // speed command [rpm]
+    {449, 998},     // feedback speed [rpm]
+    {450, 2},       // speed deviation [rpm]
+    {451, 120},     // torque command [0.1 %]
+    {452, 118},     // feedback torque [0.1 %]
+    {453, 2},       // torque deviation [0.1 %]
+    {458, 310},     // DC bus voltage [V]
+    {459, 12},      // torque load ratio [%]
+    {460, 3},       // resistance braking rate [%]
+    {461, 7},       // torque overload ratio [%]
+    {466, 0b1},     // digital inputs, servo enabled
+    {467, 0b1},     // digital outputs, servo ready
+}};
+
+/** Exception codes, from the Modbus application protocol specification. */
+constexpr uint8_t illegal_data_address {0x02};
+constexpr uint8_t illegal_data_value {0x03};
+
+int get_u16(const uint8_t *src) noexcept
+{
+    return (src[0] << 8) | src[1];
+}
+
+std::chrono::nanoseconds char_time_at(const int baud_rate) noexcept
+{
+    // 8 data bits, even parity and 1 stop bit, like the drive.
+    constexpr int bits {11};
+    return std::chrono::nanoseconds{1'000'000'000LL * bits / baud_rate};
+}
+
+int to_baud_rate(const speed_t speed) noexcept
+{
+    switch (speed) {
+        case B1200: return 1200;
+        case B2400: return 2400;
+        case B4800: return 4800;
+        case B9600: return 9600;
+        case B19200: return 19200;
+        case B38400: return 38400;
+        case B57600: return 57600;
+        case B115200: return 115200;
+        default: return 0;
+    }
+}
+
+void put_u16(std::vector<uint8_t>& dest, const int value)
+{
+    dest.push_back(static_cast<uint8_t>((value >> 8) & 0xFF));
+    dest.push_back(static_cast<uint8_t>(value & 0xFF));
+}
+
+} // namespace
+
+
+Slave_simulator::Slave_simulator(const Options& _options)
+    : options{_options}
+{
+    for (const int target : options.targets) {
+        if (target < 1 || target > 247) {
+            std::ostringstream oss;
+            oss << "ERROR: Invalid simulated target " << target << ", must be between 1 and 247\n";
+            throw std::invalid_argument(oss.str());
+        }
+        auto& regs = drives[target];
+        for (const auto& [address, value] : default_registers)
+            regs[static_cast<std::size_t>(address)] = value;
+        // PA_000 is the Modbus address.
+        regs[0x000] = static_cast<uint16_t>(target);
+        for (const auto& [address, value] : options.registers) {
+            if (!is_simulated(address, 1)) {
+                std::ostringstream oss;
+                oss << "ERROR: Register " << address << " is not simulated, must be between "
+                    << first_param << " and " << last_param << ", or " << first_reg << " and " << last_reg << "\n";
+                throw std::invalid_argument(oss.str());
+            }
+            regs[static_cast<std::size_t>(address)] = value;
+        }
+    }
+
+    if (options.baud_rate > 0)
+        char_time = char_time_at(options.baud_rate);
+
+    master_fd = ::posix_openpt(O_RDWR | O_NOCTTY | O_CLOEXEC);
+    if (master_fd < 0 || ::grantpt(master_fd) != 0 || ::unlockpt(master_fd) != 0) {
+        const int error = errno;
+        if (master_fd >= 0)
+            ::close(master_fd);
+        std::ostringstream oss;
+        oss << "ERROR: Can't create pseudo-terminal: " << std::strerror(error) << "\n";
+        throw std::runtime_error(oss.str());
+    }
+    slave_path = ::ptsname(master_fd);
+
+    // Keep the slave side open and raw, until the driver configures it.
+    slave_fd = ::open(slave_path.c_str(), O_RDWR | O_NOCTTY | O_CLOEXEC);
+    termios tios{};
+    if (slave_fd >= 0 && tcgetattr(slave_fd, &tios) == 0) {
+        cfmakeraw(&tios);
+        tcsetattr(slave_fd, TCSANOW, &tios);
+    }
+}
+
+Slave_simulator::~Slave_simulator()
+{
+    if (slave_fd >= 0)
+        ::close(slave_fd);
+    if (master_fd >= 0)
+        ::close(master_fd);
+}
+
+bool Slave_simulator::set_register(const int target, const int address, const uint16_t value)
+{
+    auto drive = drives.find(target);
+    if (drive == drives.end() || !is_simulated(address, 1))
+        return false;
+    drive->second[static_cast<std::size_t>(address)] = value;
+    return true;
+}
+
+void Slave_simulator::run(const std::atomic<bool>& done)
+{
+    // Anything left after a silent interval is an incomplete or corrupt frame.
+    const auto frame_gap = std::max(char_time * 7 / 2, std::chrono::nanoseconds{std::chrono::milliseconds{5}});
+    auto last_byte = std::chrono::steady_clock::now();
+    std::array<uint8_t, 256> buffer{};
+
+    while (!done) {
+        pollfd pfd{master_fd, POLLIN, 0};
+        const int ready = ::poll(&pfd, 1, 10);
+        if (ready < 0 && errno != EINTR)
+            throw std::runtime_error(std::string{"ERROR: poll on pseudo-terminal: "} + std::strerror(errno) + "\n");
+
+        const auto now = std::chrono::steady_clock::now();
+        if (ready <= 0) {
+            if (!rx.empty() && now - last_byte > frame_gap)
+                rx.clear();
+            continue;
+        }
+
+        const ssize_t n = ::read(master_fd, buffer.data(), buffer.size());
+        if (n <= 0)
+            continue;
+        rx.insert(rx.end(), buffer.begin(), buffer.begin() + n);
+        rx_bytes += static_cast<uint64_t>(n);
+        last_byte = now;
+
+        while (const std::size_t consumed = handle_request())
+            rx.erase(rx.begin(), rx.begin() + static_cast<long>(consumed));
+    }
+}
+
+std::size_t Slave_simulator::handle_request()
+{
+    if (rx.size() < 2)
+        return 0;
+
+    std::size_t length;
+    switch (rx[1]) {
+        case Rtu_master::read_holding_registers:
+        case Rtu_master::write_single_register:
+            length = 8;
+            break;
+        case Rtu_master::write_multiple_registers:
+            if (rx.size() < 7)
+                return 0;
+            length = 9 + std::size_t{rx[6]};
+            break;
+        default:
+            // Length unknown, wait for the silent interval to drop it.
+            return 0;
+    }
+    if (rx.size() < length)
+        return 0;
+
+    const uint16_t crc = modbus_crc16(rx.data(), length - 2);
+    if (rx[length - 2] != (crc & 0xFF) || rx[length - 1] != (crc >> 8)) {
+        // Not a frame boundary, try the next byte.
+        return 1;
+    }
+
+    const int target = rx[0];
+    const bool broadcast = target == 0;
+    const int rate = line_rate();
+    // The wire time follows the rate the driver use, when it is simulated.
+    if (options.baud_rate > 0 && rate > 0)
+        char_time = char_time_at(rate);
+    if (!broadcast && (drives.find(target) == drives.end() || !hears(target, rate)))
+        return length;
+
+    const uint8_t function = rx[1];
+    const int address = get_u16(&rx[2]);
+    std::vector<uint8_t> response{rx[0], rx[1]};
+
+    if (function == Rtu_master::read_holding_registers) {
+        const int count = get_u16(&rx[4]);
+        if (broadcast)
+            return length;
+        if (count < 1 || count > modbus_max_read_registers) {
+            exception(response, illegal_data_value);
+        } else if (!is_simulated(address, count) || rejects(address, count)) {
+            exception(response, illegal_data_address);
+        } else {
+            const auto& regs = drives[target];
+            response.push_back(static_cast<uint8_t>(2 * count));
+            for (int i = 0; i < count; i++)
+                put_u16(response, regs[static_cast<std::size_t>(address + i)]);
+        }
+    } else if (function == Rtu_master::write_single_register) {
+        if (!is_simulated(address, 1)) {
+            exception(response, illegal_data_address);
+        } else {
+            for (auto& [id, regs] : drives) {
+                if ((broadcast && hears(id, rate)) || id == target)
+                    regs[static_cast<std::size_t>(address)] = static_cast<uint16_t>(get_u16(&rx[4]));
+            }
+            response.assign(rx.begin(), rx.begin() + 6);
+        }
+    } else {
+        const int count = get_u16(&rx[4]);
+        if (count < 1 || count > modbus_max_write_registers || rx[6] != 2 * count) {
+            exception(response, illegal_data_value);
+        } else if (!is_simulated(address, count)) {
+            exception(response, illegal_data_address);
+        } else {
+            for (auto& [id, regs] : drives) {
+                if (broadcast ? !hears(id, rate) : id != target)
+                    continue;
+                for (int i = 0; i < count; i++)
+                    regs[static_cast<std::size_t>(address + i)]
+                        = static_cast<uint16_t>(get_u16(&rx[7 + 2 * static_cast<std::size_t>(i)]));
+            }
+            response.assign(rx.begin(), rx.begin() + 6);
+        }
+    }
+
+    if (!broadcast) {
+        // The request has arrived at once, the time to receive it is part of the delay.
+        std::this_thread::sleep_for(options.latency + char_time * static_cast<long>(length));
+        respond(response);
+    }
+    return length;
+}
+
+bool Slave_simulator::hears(const int target, const int line_rate) const
+{
+    const auto drive_rate = options.drive_rates.find(target);
+    const int rate = drive_rate != options.drive_rates.end() ? drive_rate->second : options.baud_rate;
+    return rate == 0 || line_rate == 0 || rate == line_rate;
+}
+
+bool Slave_simulator::rejects(const int start, const int count) const
+{
+    const auto first = options.rejected.lower_bound(start);
+    return first != options.rejected.end() && *first < start + count;
+}
+
+int Slave_simulator::line_rate() const noexcept
+{
+    termios tios{};
+    if (slave_fd < 0 || tcgetattr(slave_fd, &tios) != 0)
+        return 0;
+    return to_baud_rate(cfgetispeed(&tios));
+}
+
+void Slave_simulator::exception(std::vector<uint8_t>& response, const uint8_t code)
+{
+    response.resize(2);
+    response[1] |= 0x80U;
+    response.push_back(code);
+}
+
+void Slave_simulator::respond(std::vector<uint8_t>& response)
+{
+    const uint16_t crc = modbus_crc16(response.data(), response.size());
+    response.push_back(static_cast<uint8_t>(crc & 0xFF));
+    response.push_back(static_cast<uint8_t>(crc >> 8));
+
+    // Deliver the response no sooner than it could be transmitted.
+    if (char_time.count() > 0)
+        std::this_thread::sleep_for(char_time * static_cast<long>(response.size()));
+
+    std::size_t written = 0;
+    while (written < response.size()) {
+        const ssize_t n = ::write(master_fd, response.data() + written, response.size() - written);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            return;
+        written += static_cast<std::size_t>(n);
+    }
+    tx_bytes += written;
+    response_count++;
+}
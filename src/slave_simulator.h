@@ -0,0 +1,117 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ * Copyright (C) 2024 Håvard F. Aasen <havard.f.aasen@pfft.no>
+ */
+
+/**
+ * @file
+ * @brief Simulated Lichuan A4 drives on a pseudo-terminal.
+ */
+
+#ifndef LICHUAN_A4_SLAVE_SIMULATOR_H
+#define LICHUAN_A4_SLAVE_SIMULATOR_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+
+/**
+ * @brief Modbus RTU slave answering for one or more simulated drives.
+ *
+ * Creates a pseudo-terminal, the driver connects to the slave side given by
+ * @ref device(). Function codes 0x03, 0x06 and 0x10 is implemented for the
+ * registers used by the driver and the PA parameters, other addresses get an
+ * illegal data address exception.
+ *
+ * A drive only answers requests sent at its own baud rate, from
+ * @ref Options::drive_rates or @ref Options::baud_rate, since any other rate
+ * is noise on the line to it. A drive without a baud rate answers at any rate.
+ */
+class Slave_simulator {
+public:
+    struct Options {
+        std::vector<int> targets{1};                /*!< slave addresses to answer for */
+        int baud_rate{0};                           /*!< simulate wire time, 0 to answer at once */
+        std::chrono::microseconds latency{0};       /*!< processing time before each response */
+        std::map<int, uint16_t> registers{};        /*!< initial register values, by address */
+        std::map<int, int> drive_rates{};           /*!< baud rate of a target, when not @ref baud_rate */
+        std::set<int> rejected{};                   /*!< reads of these registers get an exception */
+    };
+
+    explicit Slave_simulator(const Options& _options);
+    Slave_simulator(const Slave_simulator&) = delete;
+    Slave_simulator& operator=(const Slave_simulator&) = delete;
+    ~Slave_simulator();
+
+    /** Path of the pseudo-terminal the driver should open. */
+    [[nodiscard]] const std::string& device() const noexcept { return slave_path; }
+
+    /**
+     * @brief Change a register of a simulated drive.
+     *
+     * Only safe while @ref run() is not active.
+     * @return @c false if the target or register is not simulated.
+     */
+    bool set_register(int target, int address, uint16_t value);
+
+    /** Answer requests until @p done is set. */
+    void run(const std::atomic<bool>& done);
+
+    /** Requests answered, and bytes sent and received. */
+    [[nodiscard]] uint64_t responses() const noexcept { return response_count; }
+    [[nodiscard]] uint64_t bytes_received() const noexcept { return rx_bytes; }
+    [[nodiscard]] uint64_t bytes_sent() const noexcept { return tx_bytes; }
+
+    /** First and last address of the simulated monitoring registers. */
+    static constexpr int first_reg {448};
+    static constexpr int last_reg {467};
+    /** First and last address of the simulated parameters, PA_000 to PA_0FF. */
+    static constexpr int first_param {0x000};
+    static constexpr int last_param {0x0FF};
+
+    /** If registers [@p start, @p start + @p count) is simulated. */
+    [[nodiscard]] static constexpr bool is_simulated(const int start, const int count) noexcept
+    {
+        const int end = start + count - 1;
+        return (start >= first_reg && end <= last_reg) || (start >= first_param && end <= last_param);
+    }
+
+private:
+    /** Indexed by address. */
+    using Registers = std::array<uint16_t, last_reg + 1>;
+
+    Options options;
+    int master_fd{-1};
+    int slave_fd{-1};       /*!< kept open, so the master side don't hang up between clients */
+    std::string slave_path{};
+    std::chrono::nanoseconds char_time{};
+    std::map<int, Registers> drives{};
+
+    std::vector<uint8_t> rx{};
+    std::atomic<uint64_t> response_count{};
+    std::atomic<uint64_t> rx_bytes{};
+    std::atomic<uint64_t> tx_bytes{};
+
+    /**
+     * @brief Handle a complete request at the start of @ref rx.
+     * @return Number of bytes consumed, 0 if the request is incomplete.
+     */
+    std::size_t handle_request();
+    /** If @p target is set to the baud rate of the line, 0 if unknown. */
+    [[nodiscard]] bool hears(int target, int line_rate) const;
+    /** If a read of registers [@p start, @p start + @p count) includes a rejected register. */
+    [[nodiscard]] bool rejects(int start, int count) const;
+    /** Baud rate the driver set on the pseudo-terminal, 0 if unknown. */
+    [[nodiscard]] int line_rate() const noexcept;
+    void respond(std::vector<uint8_t>& response);
+    static void exception(std::vector<uint8_t>& response, uint8_t code);
+};
+
+#endif // LICHUAN_A4_SLAVE_SIMULATOR_H
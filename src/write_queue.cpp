@@ -0,0 +1,113 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ * Copyright (C) 2024 Håvard F. Aasen <havard.f.aasen@pfft.no>
+ */
+
+#include "write_queue.h"
+
+#include <algorithm>
+
+
+bool Write_queue::write(const int address, const uint16_t value) noexcept
+{
+    auto entry = find(address);
+    if (entry == entries.data() + size || entry->address != address) {
+        if (size == capacity) {
+            if (!free_slot())
+                return false;
+            entry = find(address);
+        }
+        const auto end = entries.data() + size;
+        std::move_backward(entry, end, end + 1);
+        *entry = Entry{};
+        entry->address = address;
+        size++;
+    }
+
+    if (entry->is_written && entry->written == value) {
+        // Cancel a pending write of another value, the register already has this one.
+        if (!entry->is_pending)
+            dropped_count++;
+        entry->is_pending = false;
+        return true;
+    }
+    if (!entry->is_pending || entry->value != value)
+        entry->attempts = 0;
+    entry->value = value;
+    entry->is_pending = true;
+    return true;
+}
+
+Write_queue::Flush_result Write_queue::flush(Modbus& bus, const int target, const int max_transactions)
+{
+    Flush_result result{};
+    std::array<uint16_t, modbus_max_write_registers> values{};
+
+    std::size_t i = 0;
+    while (i < size && result.transactions < max_transactions) {
+        if (!entries[i].is_pending) {
+            i++;
+            continue;
+        }
+
+        // Extend the run as long as the next register is pending and contiguous.
+        std::size_t count = 1;
+        values[0] = entries[i].value;
+        while (i + count < size && count < values.size() && entries[i + count].is_pending
+               && entries[i + count].address == entries[i].address + static_cast<int>(count)) {
+            values[count] = entries[i + count].value;
+            count++;
+        }
+
+        result.transactions++;
+        const bool success = count == 1
+                ? bus.write_register(target, entries[i].address, values[0])
+                : bus.write_registers(target, entries[i].address, values.data(), static_cast<int>(count));
+        for (std::size_t j = i; j < i + count; j++) {
+            auto& entry = entries[j];
+            if (success) {
+                entry.written = entry.value;
+                entry.is_written = true;
+                entry.is_pending = false;
+            } else if (++entry.attempts >= max_attempts) {
+                // The value in the drive is unknown, so the register is forgotten.
+                entry.is_pending = false;
+                entry.is_written = false;
+                result.given_up++;
+            }
+        }
+        if (!success)
+            result.failures++;
+        i += count;
+    }
+
+    if (result.given_up > 0) {
+        const auto end = std::remove_if(entries.data(), entries.data() + size,
+                                        [](const Entry& e) { return !e.is_pending && !e.is_written; });
+        size = static_cast<std::size_t>(end - entries.data());
+    }
+    return result;
+}
+
+Write_queue::Entry* Write_queue::find(const int address) noexcept
+{
+    return std::lower_bound(entries.data(), entries.data() + size, address,
+                            [](const Entry& e, const int a) { return e.address < a; });
+}
+
+bool Write_queue::free_slot() noexcept
+{
+    const auto end = entries.data() + size;
+    const auto entry = std::find_if(entries.data(), end, [](const Entry& e) { return !e.is_pending; });
+    if (entry == end)
+        return false;
+    std::move(entry + 1, end, entry);
+    size--;
+    return true;
+}
+
+std::size_t Write_queue::pending() const noexcept
+{
+    return static_cast<std::size_t>(std::count_if(entries.begin(), entries.begin() + static_cast<long>(size),
+                                                  [](const Entry& e) { return e.is_pending; }));
+}
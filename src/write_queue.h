@@ -0,0 +1,88 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ * Copyright (C) 2024 Håvard F. Aasen <havard.f.aasen@pfft.no>
+ */
+
+/**
+ * @file
+ * @brief Queue of register writes to one drive.
+ */
+
+#ifndef LICHUAN_A4_WRITE_QUEUE_H
+#define LICHUAN_A4_WRITE_QUEUE_H
+
+#include "modbus.h"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+
+/**
+ * @brief Register writes waiting to be sent to one drive.
+ *
+ * Only the latest value of each register is kept, and a value equal to
+ * the one last written is dropped. When flushed, writes to contiguous
+ * registers is merged into one write multiple registers (0x10) request.
+ * A register which is written, or given up, only keeps its slot until the
+ * slot is needed for another register. No memory is allocated.
+ */
+class Write_queue {
+public:
+    /** Highest number of different registers with a pending write. */
+    static constexpr std::size_t capacity {64};
+    /** Number of times a write is tried, before it is given up. */
+    static constexpr int max_attempts {3};
+
+    /**
+     * @brief Queue a write of @p value to @p address.
+     * @return @c false if every slot has a pending write.
+     */
+    bool write(int address, uint16_t value) noexcept;
+
+    struct Flush_result {
+        int transactions{};     /*!< requests sent */
+        int failures{};         /*!< requests which failed */
+        int given_up{};         /*!< registers not written, after too many failures */
+    };
+
+    /**
+     * @brief Send pending writes, in register order.
+     *
+     * A failed write is retried on the next flush, and given up after
+     * @ref max_attempts failures.
+     * @param max_transactions Highest number of requests to send.
+     */
+    Flush_result flush(Modbus& bus, int target, int max_transactions);
+
+    /** Number of registers with a pending write. */
+    [[nodiscard]] std::size_t pending() const noexcept;
+
+    /** Writes dropped, since the value was already written. */
+    [[nodiscard]] uint64_t dropped() const noexcept { return dropped_count; }
+
+private:
+    struct Entry {
+        int address{};
+        uint16_t value{};       /*!< value to write, when pending */
+        uint16_t written{};     /*!< value last written successfully */
+        int attempts{};         /*!< failed attempts to write value */
+        bool is_written{false};
+        bool is_pending{false};
+    };
+
+    /** Sorted by address. */
+    std::array<Entry, capacity> entries{};
+    std::size_t size{};
+    uint64_t dropped_count{};
+
+    /** First entry with an address not less than @p address. */
+    [[nodiscard]] Entry* find(int address) noexcept;
+    /**
+     * @brief Forget one register without a pending write.
+     * @return @c false if every register has a pending write.
+     */
+    bool free_slot() noexcept;
+};
+
+#endif // LICHUAN_A4_WRITE_QUEUE_H
@@ -0,0 +1,28 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ * Copyright (C) 2024 Håvard F. Aasen <havard.f.aasen@pfft.no>
+ */
+
+/**
+ * @file
+ * @brief Checks shared by the tests.
+ */
+
+#ifndef LICHUAN_A4_CHECK_H
+#define LICHUAN_A4_CHECK_H
+
+#include <iostream>
+
+
+/** Failed checks, the exit status of a test. */
+inline int failures {0};
+
+#define CHECK(condition)                                                                    \
+    do {                                                                                    \
+        if (!(condition)) {                                                                 \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": FAILED: " #condition "\n";       \
+            failures++;                                                                     \
+        }                                                                                   \
+    } while (false)
+
+#endif // LICHUAN_A4_CHECK_H
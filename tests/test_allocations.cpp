@@ -0,0 +1,71 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ * Copyright (C) 2024 Håvard F. Aasen <havard.f.aasen@pfft.no>
+ */
+
+/**
+ * @file
+ * @brief The polling cycle allocates no memory, once it is running.
+ *
+ * Global operator new and delete is replaced, to count the allocations of
+ * the polling thread. The simulator thread is not counted.
+ */
+
+#include "test_support.h"
+
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+
+static std::atomic<uint64_t> allocations {0};
+static thread_local bool counting {false};
+
+static void* allocate(const std::size_t size)
+{
+    if (counting)
+        allocations++;
+    if (void *ptr = std::malloc(size == 0 ? 1 : size))
+        return ptr;
+    throw std::bad_alloc{};
+}
+
+void* operator new(const std::size_t size) { return allocate(size); }
+void* operator new[](const std::size_t size) { return allocate(size); }
+void operator delete(void *ptr) noexcept { std::free(ptr); }
+void operator delete[](void *ptr) noexcept { std::free(ptr); }
+void operator delete(void *ptr, std::size_t) noexcept { std::free(ptr); }
+void operator delete[](void *ptr, std::size_t) noexcept { std::free(ptr); }
+
+static constexpr int warmup_cycles {10};
+static constexpr int measured_cycles {300};
+
+int main()
+{
+    Slave_simulator::Options options;
+    options.targets = {1, 2};
+    Simulated_drives bus{options};
+    // Read the monitoring group on some cycles only, so the read plan changes.
+    for (auto *pins : bus.pins)
+        pins->monitor_polling = 0.005;
+
+    for (int i = 0; i < warmup_cycles; i++)
+        bus.cycle();
+
+    counting = true;
+    for (int i = 0; i < measured_cycles; i++) {
+        // A queued write now and then, sent ahead of the reads.
+        if (i % 10 == 0)
+            bus.drives.front().write_register(448, static_cast<uint16_t>(1000 + i));
+        bus.cycle();
+    }
+    counting = false;
+
+    std::cout << allocations << " allocations in " << measured_cycles << " cycles of "
+              << bus.drives.size() << " drives\n";
+    CHECK(allocations == 0);
+    CHECK(bus.bus.statistics().transactions > static_cast<uint64_t>(measured_cycles));
+    for (const auto *pins : bus.pins)
+        CHECK(pins->modbus_errors == 0 && pins->write_errors == 0);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,114 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ * Copyright (C) 2024 Håvard F. Aasen <havard.f.aasen@pfft.no>
+ */
+
+/**
+ * @file
+ * @brief State changes and probe backoff of the drive health, at given points in time.
+ */
+
+#include "check.h"
+#include "drive_health.h"
+
+#include <algorithm>
+#include <chrono>
+
+
+using namespace std::chrono_literals;
+using State = Drive_health::State;
+
+static constexpr int retries {5};
+
+/** Fail until the drive is offline, starting at @p now. */
+static void take_offline(Drive_health& health, const Drive_health::clock::time_point now)
+{
+    for (int i = 0; i < Drive_health::offline_threshold; i++)
+        health.record(false, now);
+}
+
+static void test_offline()
+{
+    const Drive_health::clock::time_point start{};
+    Drive_health health;
+    CHECK(health.get_state() == State::online);
+    CHECK(health.attempts(retries) == retries);
+
+    // The first failure, the drive is degraded and get no retries.
+    CHECK(health.record(false, start));
+    CHECK(health.get_state() == State::degraded);
+    CHECK(health.online());
+    CHECK(health.attempts(retries) == 1);
+    CHECK(health.poll_due(start));
+
+    CHECK(!health.record(false, start + 10ms));
+    CHECK(health.get_state() == State::degraded);
+
+    // Offline after the third failure in a row.
+    CHECK(health.record(false, start + 20ms));
+    CHECK(health.get_state() == State::offline);
+    CHECK(!health.online());
+    CHECK(health.transitions() == 2);
+
+    // A success in between starts the count over.
+    Drive_health flaky;
+    flaky.record(false, start);
+    flaky.record(false, start);
+    CHECK(flaky.record(true, start));
+    CHECK(flaky.get_state() == State::online);
+    flaky.record(false, start);
+    flaky.record(false, start);
+    CHECK(flaky.get_state() == State::degraded);
+}
+
+static void test_probe_backoff()
+{
+    auto now = Drive_health::clock::time_point{};
+    Drive_health health;
+    take_offline(health, now);
+
+    // The interval doubles after each failed probe, up to the highest interval.
+    std::chrono::milliseconds interval{Drive_health::min_probe_interval};
+    for (int probe = 0; probe < 8; probe++) {
+        CHECK(!health.poll_due(now + interval - 1ms));
+        CHECK(health.poll_due(now + interval));
+        now += interval;
+        CHECK(!health.record(false, now));
+        interval = std::min(interval * 2, std::chrono::milliseconds{Drive_health::max_probe_interval});
+    }
+    CHECK(interval == Drive_health::max_probe_interval);
+    CHECK(!health.poll_due(now + 8s - 1ms));
+    CHECK(health.poll_due(now + 8s));
+    CHECK(health.transitions() == 2);
+}
+
+static void test_recovery()
+{
+    auto now = Drive_health::clock::time_point{};
+    Drive_health health;
+    take_offline(health, now);
+    now += 250ms;
+    health.record(false, now);
+    now += 500ms;
+
+    // A successful probe brings the drive online, with retries.
+    CHECK(health.poll_due(now));
+    CHECK(health.record(true, now));
+    CHECK(health.get_state() == State::online);
+    CHECK(health.attempts(retries) == retries);
+    CHECK(health.transitions() == 3);
+
+    // The backoff starts over at the shortest interval.
+    take_offline(health, now);
+    CHECK(!health.poll_due(now + Drive_health::min_probe_interval - 1ms));
+    CHECK(health.poll_due(now + Drive_health::min_probe_interval));
+    CHECK(health.transitions() == 5);
+}
+
+int main()
+{
+    test_offline();
+    test_probe_backoff();
+    test_recovery();
+    return failures == 0 ? 0 : 1;
+}
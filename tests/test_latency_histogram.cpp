@@ -0,0 +1,109 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ * Copyright (C) 2024 Håvard F. Aasen <havard.f.aasen@pfft.no>
+ */
+
+/**
+ * @file
+ * @brief Percentiles of the logarithmic latency histogram, from known samples.
+ */
+
+#include "check.h"
+#include "latency_histogram.h"
+
+#include <chrono>
+#include <cstdint>
+
+
+using namespace std::chrono_literals;
+using std::chrono::microseconds;
+
+static void record(Latency_histogram& histogram, const microseconds latency, const int count = 1)
+{
+    for (int i = 0; i < count; i++)
+        histogram.record(latency);
+}
+
+static void test_empty()
+{
+    Latency_histogram histogram;
+    CHECK(histogram.percentile(0.5) == 0us);
+    CHECK(histogram.max() == 0us);
+    CHECK(histogram.mean() == 0us);
+
+    record(histogram, 10us);
+    histogram.reset();
+    CHECK(histogram.count() == 0);
+    CHECK(histogram.percentile(0.99) == 0us);
+}
+
+static void test_exact_buckets()
+{
+    // Below 8 us, each microsecond has its own bucket.
+    Latency_histogram histogram;
+    for (int us = 1; us <= 7; us++)
+        record(histogram, microseconds{us});
+    CHECK(histogram.percentile(0.0) == 1us);
+    CHECK(histogram.percentile(0.5) == 4us);
+    CHECK(histogram.percentile(1.0) == 7us);
+    CHECK(histogram.mean() == 4us);
+
+    // Sub-microsecond and negative latencies is counted as 0.
+    Latency_histogram small;
+    small.record(std::chrono::nanoseconds{999});
+    small.record(std::chrono::nanoseconds{-5});
+    CHECK(small.percentile(1.0) == 0us);
+}
+
+static void test_percentile()
+{
+    // 100 us is in the bucket 96 to 103 us, 1000 us in the bucket 960 to 1023 us.
+    Latency_histogram histogram;
+    record(histogram, 100us, 90);
+    record(histogram, 1000us, 10);
+    CHECK(histogram.count() == 100);
+    CHECK(histogram.percentile(0.50) == 103us);
+    CHECK(histogram.percentile(0.90) == 103us);
+    // Never above the maximum, even if the bucket goes higher.
+    CHECK(histogram.percentile(0.91) == 1000us);
+    CHECK(histogram.percentile(0.99) == 1000us);
+    CHECK(histogram.max() == 1000us);
+    CHECK(histogram.mean() == 190us);
+}
+
+static void test_accuracy()
+{
+    // The upper limit of a bucket is within 12.5% of any value in it.
+    const microseconds longest{16'000'000};
+    for (int64_t us = 8; us < longest.count(); us += us / 7 + 1) {
+        Latency_histogram histogram;
+        record(histogram, microseconds{us});
+        record(histogram, longest);
+        const auto p50 = histogram.percentile(0.5).count();
+        CHECK(p50 >= us && p50 <= us + us / 8);
+    }
+}
+
+static void test_overflow()
+{
+    // Above about 33.5 s every latency is in the last bucket.
+    Latency_histogram histogram;
+    record(histogram, 10us, 98);
+    record(histogram, 40s);
+    record(histogram, 60s);
+    CHECK(histogram.percentile(0.98) == 10us);
+    CHECK(histogram.percentile(0.99) == 60s);
+    CHECK(histogram.percentile(1.0) == 60s);
+    CHECK(histogram.max() == 60s);
+    CHECK(histogram.mean() == microseconds{(98 * 10 + 40'000'000 + 60'000'000) / 100});
+}
+
+int main()
+{
+    test_empty();
+    test_exact_buckets();
+    test_percentile();
+    test_accuracy();
+    test_overflow();
+    return failures == 0 ? 0 : 1;
+}
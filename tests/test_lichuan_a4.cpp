@@ -0,0 +1,170 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ * Copyright (C) 2024 Håvard F. Aasen <havard.f.aasen@pfft.no>
+ */
+
+/**
+ * @file
+ * @brief Read, decode and publish cycle of one drive, against a simulated drive.
+ */
+
+#include "test_support.h"
+
+#include <cstdint>
+
+
+static constexpr std::size_t commanded_speed {number_index("commanded-speed")};
+static constexpr std::size_t feedback_speed {number_index("feedback-speed")};
+static constexpr std::size_t commanded_torque {number_index("commanded-torque")};
+static constexpr std::size_t dc_bus_volt {number_index("dc-bus-volt")};
+static constexpr std::size_t active_alarm {register_map::bit_index("active-alarm")};
+
+static constexpr int alarm_output_reg {467};
+static constexpr uint16_t alarm_output {0b11};    // servo ready and alarm
+static constexpr uint16_t no_alarm_output {0b1};
+
+static void test_decode()
+{
+    Slave_simulator::Options options;
+    options.registers = {{448, 0xFFF6}, {449, 0x8000}, {451, 123}};
+    Simulated_drives bus{options};
+    bus.cycle();
+    const Pin_data& pins = *bus.pins.front();
+
+    CHECK(*pins.numbers[commanded_speed] == -10.0);
+    CHECK(*pins.numbers[feedback_speed] == -32768.0);
+    CHECK(*pins.numbers[commanded_torque] > 12.29 && *pins.numbers[commanded_torque] < 12.31);
+    CHECK(*pins.numbers[dc_bus_volt] == 310.0);
+    CHECK(*pins.bits[register_map::bit_index("servo-ready")]);
+    CHECK(!*pins.bits[active_alarm]);
+}
+
+static void test_publish()
+{
+    Simulated_drives bus{Slave_simulator::Options{}};
+    const Pin_data& pins = *bus.pins.front();
+
+    bus.cycle();
+    const uint32_t first = *pins.sequence;
+    CHECK(first > 0 && first % 2 == 0);
+
+    // Nothing changed, nothing is published.
+    bus.cycle();
+    CHECK(*pins.sequence == first);
+
+    // An unchanged value is not stored again, the sentinel is left alone.
+    *pins.numbers[dc_bus_volt] = -1.0;
+    CHECK(bus.bus.write_register(1, 448, 1500));
+    bus.cycle();
+    CHECK(*pins.sequence == first + 2);
+    CHECK(*pins.numbers[commanded_speed] == 1500.0);
+    CHECK(*pins.numbers[dc_bus_volt] == -1.0);
+}
+
+static void test_alarm()
+{
+    Simulated_drives bus{Slave_simulator::Options{}};
+    const Pin_data& pins = *bus.pins.front();
+    bus.cycle();
+    CHECK(*pins.alarm_count == 0);
+
+    // Reads of a cycle without an alarm.
+    auto before = bus.transactions();
+    bus.cycle();
+    const auto reads = bus.transactions() - before;
+
+    CHECK(bus.bus.write_register(1, Lichuan_a4::probe_reg, 12));
+    CHECK(bus.bus.write_register(1, alarm_output_reg, alarm_output));
+
+    // The error code is read on the rising edge.
+    before = bus.transactions();
+    bus.cycle();
+    CHECK(bus.transactions() - before == reads + 1);
+    CHECK(*pins.bits[active_alarm]);
+    CHECK(*pins.error_code == 12);
+    CHECK(*pins.alarm_count == 1);
+    CHECK(*pins.alarms[0].code == 12);
+    CHECK(*pins.alarms[0].first_seen > 0.0);
+    CHECK(*pins.alarms[0].cleared == 0.0);
+
+    // Confirmed in the next cycle, the drive changed its mind.
+    CHECK(bus.bus.write_register(1, Lichuan_a4::probe_reg, 13));
+    before = bus.transactions();
+    bus.cycle();
+    CHECK(bus.transactions() - before == reads + 1);
+    CHECK(*pins.error_code == 13);
+    CHECK(*pins.alarms[0].code == 13);
+
+    // Not read while the alarm is latched.
+    before = bus.transactions();
+    for (int i = 0; i < 5; i++)
+        bus.cycle();
+    CHECK(bus.transactions() - before == 5 * reads);
+
+    // The falling edge clears the error code, and ends the alarm.
+    CHECK(bus.bus.write_register(1, alarm_output_reg, no_alarm_output));
+    CHECK(bus.bus.write_register(1, Lichuan_a4::probe_reg, 0));
+    before = bus.transactions();
+    bus.cycle();
+    CHECK(bus.transactions() - before == reads);
+    CHECK(*pins.error_code == 0);
+    CHECK(*pins.alarms[0].code == 13);
+    CHECK(*pins.alarms[0].cleared >= *pins.alarms[0].first_seen);
+    CHECK(*pins.alarms[0].duration > 0.0);
+
+    // A second alarm is the newest entry.
+    CHECK(bus.bus.write_register(1, Lichuan_a4::probe_reg, 21));
+    CHECK(bus.bus.write_register(1, alarm_output_reg, alarm_output));
+    bus.cycle();
+    CHECK(*pins.alarm_count == 2);
+    CHECK(*pins.alarms[0].code == 21);
+    CHECK(*pins.alarms[1].code == 13);
+}
+
+static void test_rejected_gap()
+{
+    Slave_simulator::Options options;
+    options.rejected = {455};
+    Simulated_drives bus{options, 4};
+    const Pin_data& pins = *bus.pins.front();
+
+    // The merged read is rejected, the groups is read on their own in the same cycle.
+    bus.cycle();
+    CHECK(*pins.online);
+    CHECK(pins.modbus_errors == 1);
+    CHECK(pins.health_transitions == 0);
+    CHECK(*pins.numbers[dc_bus_volt] == 310.0);
+    CHECK(*pins.bits[register_map::bit_index("servo-ready")]);
+
+    // And is not merged again.
+    const auto before = bus.transactions();
+    bus.cycle();
+    CHECK(bus.transactions() - before == register_map::group_count);
+    CHECK(pins.modbus_errors == 1);
+}
+
+static void test_monitor_disabled()
+{
+    // Any read of the monitoring registers is an exception.
+    Slave_simulator::Options options;
+    options.rejected = {458, 459, 460, 461};
+    Simulated_drives bus{options};
+    Pin_data& pins = *bus.pins.front();
+    pins.monitor_enable = false;
+
+    bus.cycle();
+    bus.cycle();
+    CHECK(pins.modbus_errors == 0);
+    CHECK(*pins.numbers[dc_bus_volt] == 0.0);
+    CHECK(*pins.bits[register_map::bit_index("servo-ready")]);
+}
+
+int main()
+{
+    test_decode();
+    test_publish();
+    test_alarm();
+    test_rejected_gap();
+    test_monitor_disabled();
+    return failures == 0 ? 0 : 1;
+}
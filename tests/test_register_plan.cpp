@@ -0,0 +1,101 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ * Copyright (C) 2024 Håvard F. Aasen <havard.f.aasen@pfft.no>
+ */
+
+/**
+ * @file
+ * @brief Merging of register groups into read blocks.
+ */
+
+#include "check.h"
+#include "register_plan.h"
+
+#include <array>
+#include <initializer_list>
+
+
+static bool has_blocks(const Register_plan& plan, std::initializer_list<Register_block> expected)
+{
+    if (plan.size() != expected.size())
+        return false;
+    const Register_block *block = plan.begin();
+    for (const auto& want : expected) {
+        if (block->start != want.start || block->count != want.count)
+            return false;
+        ++block;
+    }
+    return true;
+}
+
+static void test_gap()
+{
+    const std::array<Register_group, 2> groups{{{10, 2}, {15, 1}}};
+    Register_plan plan;
+
+    // Three unused registers, 12 to 14, between the groups.
+    plan.plan(groups, Register_plan::all_groups, 3);
+    CHECK(has_blocks(plan, {{10, 6}}));
+    CHECK(plan.begin()->contains(groups[0]) && plan.begin()->contains(groups[1]));
+
+    plan.plan(groups, Register_plan::all_groups, 2);
+    CHECK(has_blocks(plan, {{10, 2}, {15, 1}}));
+
+    // Adjacent groups is merged without a gap, but not with a negative one.
+    const std::array<Register_group, 2> adjacent{{{10, 2}, {12, 3}}};
+    plan.plan(adjacent, Register_plan::all_groups, 0);
+    CHECK(has_blocks(plan, {{10, 5}}));
+    plan.plan(adjacent, Register_plan::all_groups, -1);
+    CHECK(has_blocks(plan, {{10, 2}, {12, 3}}));
+
+    const std::array<Register_group, 2> overlapping{{{10, 4}, {12, 4}}};
+    plan.plan(overlapping, Register_plan::all_groups, -1);
+    CHECK(has_blocks(plan, {{10, 6}}));
+}
+
+static void test_max_count()
+{
+    Register_plan plan;
+
+    const std::array<Register_group, 2> fits{{{0, 100}, {100, 25}}};
+    plan.plan(fits, Register_plan::all_groups, 0);
+    CHECK(has_blocks(plan, {{0, modbus_max_read_registers}}));
+
+    const std::array<Register_group, 2> too_many{{{0, 100}, {100, 26}}};
+    plan.plan(too_many, Register_plan::all_groups, 0);
+    CHECK(has_blocks(plan, {{0, 100}, {100, 26}}));
+
+    // The gap counts towards the limit.
+    const std::array<Register_group, 2> gap{{{0, 100}, {110, 16}}};
+    plan.plan(gap, Register_plan::all_groups, 10);
+    CHECK(has_blocks(plan, {{0, 100}, {110, 16}}));
+
+    plan.plan(fits, Register_plan::all_groups, 0, 50);
+    CHECK(has_blocks(plan, {{0, 100}, {100, 25}}));
+}
+
+static void test_unsorted()
+{
+    const std::array<Register_group, 4> groups{{{20, 2}, {0, 2}, {10, 2}, {5, 0}}};
+    Register_plan plan;
+
+    plan.plan(groups, Register_plan::all_groups, 0);
+    CHECK(has_blocks(plan, {{0, 2}, {10, 2}, {20, 2}}));
+
+    plan.plan(groups, Register_plan::all_groups, 8);
+    CHECK(has_blocks(plan, {{0, 22}}));
+
+    // Only the selected groups is read.
+    plan.plan(groups, 0b011, 8);
+    CHECK(has_blocks(plan, {{0, 2}, {20, 2}}));
+    plan.plan(groups, 0b1000, 8);
+    CHECK(plan.empty());
+}
+
+int main()
+{
+    test_gap();
+    test_max_count();
+    test_unsorted();
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,94 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ * Copyright (C) 2024 Håvard F. Aasen <havard.f.aasen@pfft.no>
+ */
+
+/**
+ * @file
+ * @brief Simulated drives shared by the tests.
+ */
+
+#ifndef LICHUAN_A4_TEST_SUPPORT_H
+#define LICHUAN_A4_TEST_SUPPORT_H
+
+#include "check.h"
+#include "lichuan_a4.h"
+#include "memory_pins.h"
+#include "modbus.h"
+#include "register_map.h"
+#include "slave_simulator.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <iostream>
+#include <list>
+#include <memory>
+#include <string_view>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+/**
+ * @brief Drives on a simulated bus, publishing to process memory.
+ *
+ * Every register group is read on every cycle.
+ */
+class Simulated_drives {
+public:
+    explicit Simulated_drives(const Slave_simulator::Options& options, int max_gap = Lichuan_a4::default_max_gap)
+        : simulator{options}
+        , slave{[this] { simulator.run(done); }}
+        , bus{simulator.device(), baud_rate, Lichuan_a4::data_bits, Lichuan_a4::parity, Lichuan_a4::stop_bits}
+    {
+        // Long enough that a stall of the test machine is not a timeout, and a retry.
+        bus.set_response_timeout(std::chrono::milliseconds{500});
+        for (const int target : options.targets) {
+            auto memory_pins = std::make_unique<Memory_pins>();
+            Pin_data& data = memory_pins->data();
+            data.monitor_polling = 0.0;
+            data.monitor_enable = true;
+            pins.push_back(&data);
+            drives.emplace_back("test." + std::to_string(target), std::move(memory_pins), bus, target, max_gap);
+        }
+    }
+    Simulated_drives(const Simulated_drives&) = delete;
+    Simulated_drives& operator=(const Simulated_drives&) = delete;
+    ~Simulated_drives()
+    {
+        done = true;
+        slave.join();
+    }
+
+    /** Run one polling cycle of every drive. */
+    void cycle()
+    {
+        for (auto& drive : drives)
+            drive.read_data();
+    }
+
+    /** Requests sent by the driver since the bus was opened. */
+    [[nodiscard]] uint64_t transactions() const noexcept { return bus.statistics().transactions; }
+
+    static constexpr int baud_rate {115200};
+
+    Slave_simulator simulator;
+    std::atomic<bool> done{false};
+    std::thread slave;
+    Modbus bus;
+    std::list<Lichuan_a4> drives{};
+    std::vector<Pin_data*> pins{};
+};
+
+/** Index of the number field published to @p pin. */
+constexpr std::size_t number_index(const std::string_view pin) noexcept
+{
+    for (std::size_t i = 0; i < register_map::fields.size(); i++) {
+        if (register_map::fields[i].type == register_map::Pin_type::float_pin && pin == register_map::fields[i].pin)
+            return register_map::index_of(i);
+    }
+    return register_map::float_count;
+}
+
+#endif // LICHUAN_A4_TEST_SUPPORT_H
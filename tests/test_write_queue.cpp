@@ -0,0 +1,118 @@
+/*
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ * Copyright (C) 2024 Håvard F. Aasen <havard.f.aasen@pfft.no>
+ */
+
+/**
+ * @file
+ * @brief Coalescing, dropping and retrying of queued register writes.
+ */
+
+#include "test_support.h"
+#include "write_queue.h"
+
+#include <array>
+#include <cstdint>
+
+
+/** Parameters PA_010 and up, which the simulated drive accepts. */
+static constexpr int first_param {0x010};
+/** Outside every simulated register, a write is answered with an exception. */
+static constexpr int rejected_reg {1000};
+
+static void test_coalesce()
+{
+    Simulated_drives bus{Slave_simulator::Options{}};
+    Write_queue queue;
+
+    // Out of order, and a register written twice, only the latest value is kept.
+    CHECK(queue.write(first_param + 2, 3));
+    CHECK(queue.write(first_param, 1));
+    CHECK(queue.write(first_param + 1, 7));
+    CHECK(queue.write(first_param + 1, 2));
+    CHECK(queue.write(first_param + 5, 5));
+    CHECK(queue.pending() == 4);
+
+    // One write multiple registers request for the contiguous registers, one for the last.
+    const auto before = bus.transactions();
+    const auto result = queue.flush(bus.bus, 1, 10);
+    CHECK(result.transactions == 2);
+    CHECK(result.failures == 0);
+    CHECK(bus.transactions() - before == 2);
+    CHECK(queue.pending() == 0);
+
+    std::array<uint16_t, 6> values{};
+    CHECK(bus.bus.read_registers(1, first_param, values));
+    CHECK(values[0] == 1 && values[1] == 2 && values[2] == 3 && values[5] == 5);
+}
+
+static void test_drop_unchanged()
+{
+    Simulated_drives bus{Slave_simulator::Options{}};
+    Write_queue queue;
+
+    CHECK(queue.write(first_param, 10));
+    CHECK(queue.flush(bus.bus, 1, 10).transactions == 1);
+
+    // The register already has the value.
+    CHECK(queue.write(first_param, 10));
+    CHECK(queue.pending() == 0);
+    CHECK(queue.dropped() == 1);
+    CHECK(queue.flush(bus.bus, 1, 10).transactions == 0);
+
+    // Changed and changed back before the flush, the pending write is cancelled.
+    CHECK(queue.write(first_param, 11));
+    CHECK(queue.write(first_param, 10));
+    CHECK(queue.pending() == 0);
+    CHECK(queue.flush(bus.bus, 1, 10).transactions == 0);
+}
+
+static void test_give_up()
+{
+    Simulated_drives bus{Slave_simulator::Options{}};
+    Write_queue queue;
+
+    CHECK(queue.write(rejected_reg, 1));
+    for (int attempt = 1; attempt < Write_queue::max_attempts; attempt++) {
+        const auto result = queue.flush(bus.bus, 1, 10);
+        CHECK(result.failures == 1);
+        CHECK(result.given_up == 0);
+        CHECK(queue.pending() == 1);
+    }
+    const auto result = queue.flush(bus.bus, 1, 10);
+    CHECK(result.failures == 1);
+    CHECK(result.given_up == 1);
+    CHECK(queue.pending() == 0);
+    CHECK(queue.flush(bus.bus, 1, 10).transactions == 0);
+
+    // A register given up is forgotten, the same value is written again.
+    CHECK(queue.write(rejected_reg, 1));
+    CHECK(queue.pending() == 1);
+}
+
+static void test_slots_reused()
+{
+    Simulated_drives bus{Slave_simulator::Options{}};
+    Write_queue queue;
+
+    // Every write is acknowledged, so there is always room for more registers.
+    for (int i = 0; i < 3 * static_cast<int>(Write_queue::capacity); i++) {
+        CHECK(queue.write(first_param + i, static_cast<uint16_t>(i + 1)));
+        CHECK(queue.flush(bus.bus, 1, 10).failures == 0);
+    }
+
+    // But not for more pending writes than the capacity.
+    for (int i = 0; i < static_cast<int>(Write_queue::capacity); i++)
+        CHECK(queue.write(first_param + i, 0));
+    CHECK(!queue.write(first_param + static_cast<int>(Write_queue::capacity), 0));
+    CHECK(queue.pending() == Write_queue::capacity);
+}
+
+int main()
+{
+    test_coalesce();
+    test_drop_unchanged();
+    test_give_up();
+    test_slots_reused();
+    return failures == 0 ? 0 : 1;
+}